@@ -17,10 +17,33 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
  */
 
+#define _GNU_SOURCE /* memfd_create, MSG_CMSG_CLOEXEC */
 #define COBJMACROS
 #include <d3dcommon.h>
 #include <vkd3d_shader.h>
+#include "d3dcompiler_native.h"
 #include <stdlib.h> /* malloc, free */
+#include <stdint.h>
+#include <string.h>
+#include <strings.h> /* strncasecmp */
+#include <errno.h>
+#include <locale.h> /* newlocale, strtod_l */
+#include <pthread.h>
+#include <fcntl.h> /* F_ADD_SEALS, F_GET_SEALS */
+#include <sys/mman.h> /* mmap, munmap, memfd_create */
+#include <sys/socket.h>
+#include <sys/stat.h> /* fstat */
+#include <sys/time.h> /* struct timeval */
+#include <sys/un.h>
+#include <unistd.h> /* close */
+
+#ifdef D3DCOMPILER_SERVER
+#include <signal.h>
+#include <spawn.h> /* posix_spawn */
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h> /* waitpid */
+#endif
 
 #define D3DCOMPILE_DEBUG 0x00000001
 
@@ -30,16 +53,86 @@
 #define WARN(fmt, ...)
 #define FIXME(fmt, ...)
 
-/* ID3DBlob Implementation */
-
 typedef struct CompilerBlob
 {
     ID3D10BlobVtbl* lpVtbl;
     ULONG refcount;
     LPVOID blob;
     SIZE_T size;
+    BOOL mapped; /* blob is an mmap of shared memory, not malloc */
+    int fd; /* Shared memory backing the mapping, or -1 */
+    D3DCOMPILER_BLOB_KIND kind;
 } CompilerBlob;
 
+/* Blob Memory Accounting */
+
+static D3DCOMPILER_MEMORY_STATS blob_stats;
+static PFN_D3DCOMPILER_BUDGET_CALLBACK blob_budget_callback;
+static void *blob_budget_userdata;
+static pthread_mutex_t blob_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void CompilerBlob_Track(CompilerBlob *blob)
+{
+    PFN_D3DCOMPILER_BUDGET_CALLBACK callback = NULL;
+    D3DCOMPILER_MEMORY_STATS stats;
+    void *userdata = NULL;
+
+    pthread_mutex_lock(&blob_stats_lock);
+    blob_stats.Bytes[blob->kind] += blob->size;
+    blob_stats.Count[blob->kind] += 1;
+    blob_stats.TotalBytes += blob->size;
+    if (blob_stats.TotalBytes > blob_stats.HighWaterBytes)
+        blob_stats.HighWaterBytes = blob_stats.TotalBytes;
+    if (blob_stats.Budget > 0 && blob_stats.TotalBytes > blob_stats.Budget)
+    {
+        callback = blob_budget_callback;
+        userdata = blob_budget_userdata;
+        stats = blob_stats;
+    }
+    pthread_mutex_unlock(&blob_stats_lock);
+
+    /* Called unlocked, so that the callback is free to Release blobs */
+    if (callback != NULL)
+        callback(&stats, userdata);
+}
+
+static void CompilerBlob_Untrack(CompilerBlob *blob)
+{
+    pthread_mutex_lock(&blob_stats_lock);
+    blob_stats.Bytes[blob->kind] -= blob->size;
+    blob_stats.Count[blob->kind] -= 1;
+    blob_stats.TotalBytes -= blob->size;
+    pthread_mutex_unlock(&blob_stats_lock);
+}
+
+void WINAPI D3DCompilerGetMemoryStats(D3DCOMPILER_MEMORY_STATS *pStats)
+{
+    pthread_mutex_lock(&blob_stats_lock);
+    *pStats = blob_stats;
+    pthread_mutex_unlock(&blob_stats_lock);
+}
+
+void WINAPI D3DCompilerResetHighWaterMark(void)
+{
+    pthread_mutex_lock(&blob_stats_lock);
+    blob_stats.HighWaterBytes = blob_stats.TotalBytes;
+    pthread_mutex_unlock(&blob_stats_lock);
+}
+
+void WINAPI D3DCompilerSetMemoryBudget(
+    SIZE_T Budget,
+    PFN_D3DCOMPILER_BUDGET_CALLBACK Callback,
+    void *pUserData
+) {
+    pthread_mutex_lock(&blob_stats_lock);
+    blob_stats.Budget = Budget;
+    blob_budget_callback = Callback;
+    blob_budget_userdata = pUserData;
+    pthread_mutex_unlock(&blob_stats_lock);
+}
+
+/* ID3DBlob Implementation */
+
 static HRESULT STDMETHODCALLTYPE CompilerBlob_QueryInterface(
     ID3D10Blob *This,
     REFIID riid,
@@ -61,7 +154,16 @@ static ULONG STDMETHODCALLTYPE CompilerBlob_Release(ID3D10Blob *This)
     {
         return --blob->refcount;
     }
-    free(blob->blob);
+    CompilerBlob_Untrack(blob);
+    if (blob->mapped)
+    {
+        if (blob->size > 0)
+            munmap(blob->blob, blob->size);
+        if (blob->fd >= 0)
+            close(blob->fd);
+    }
+    else
+        free(blob->blob);
     free(blob);
     return 0;
 }
@@ -78,35 +180,122 @@ static SIZE_T STDMETHODCALLTYPE CompilerBlob_GetBufferSize(ID3D10Blob *This)
     return blob->size;
 }
 
-static HRESULT D3DCreateBlob(SIZE_T Size, ID3DBlob **ppBlob)
+static ID3D10BlobVtbl CompilerBlob_Vtbl =
+{
+    .QueryInterface = CompilerBlob_QueryInterface,
+    .AddRef = CompilerBlob_AddRef,
+    .Release = CompilerBlob_Release,
+    .GetBufferPointer = CompilerBlob_GetBufferPointer,
+    .GetBufferSize = CompilerBlob_GetBufferSize
+};
+
+static CompilerBlob* CompilerBlob_Alloc(SIZE_T Size, D3DCOMPILER_BLOB_KIND Kind)
+{
+    CompilerBlob *blob = (CompilerBlob*) malloc(sizeof(CompilerBlob));
+    if (blob == NULL)
+        return NULL;
+
+    /* ID3DBlob */
+    blob->lpVtbl = &CompilerBlob_Vtbl;
+
+    /* CompilerBlob */
+    blob->refcount = 1;
+    blob->blob = NULL;
+    blob->size = Size;
+    blob->mapped = FALSE;
+    blob->fd = -1;
+    blob->kind = Kind;
+    return blob;
+}
+
+static HRESULT CompilerBlob_Create(SIZE_T Size, D3DCOMPILER_BLOB_KIND Kind, ID3DBlob **ppBlob)
 {
     CompilerBlob *blob;
 
     if (ppBlob == NULL)
         return E_INVALIDARG;
 
-    blob = (CompilerBlob*) malloc(sizeof(CompilerBlob));
+    blob = CompilerBlob_Alloc(Size, Kind);
     if (blob == NULL)
         return E_OUTOFMEMORY;
 
-    /* ID3DBlob */
-    blob->lpVtbl->QueryInterface = CompilerBlob_QueryInterface;
-    blob->lpVtbl->AddRef = CompilerBlob_AddRef;
-    blob->lpVtbl->Release = CompilerBlob_Release;
-    blob->lpVtbl->GetBufferPointer = CompilerBlob_GetBufferPointer;
-    blob->lpVtbl->GetBufferSize = CompilerBlob_GetBufferSize;
-
-    /* CompilerBlob */
-    blob->refcount = 1;
     blob->blob = malloc(Size);
     if (blob->blob == NULL)
+    {
+        free(blob);
         return E_OUTOFMEMORY;
-    blob->size = Size;
+    }
+
+    CompilerBlob_Track(blob);
+    *ppBlob = (ID3DBlob*) blob;
+    return S_OK;
+}
+
+#ifdef D3DCOMPILER_SERVER
+
+/* Copies a finished result to shared memory, so that it can be handed to
+ * clients as a file descriptor. Only results are shared, so that the blobs
+ * of a compile in progress do not use up descriptors. The contents are
+ * written before any mapping exists and then sealed, so that no client can
+ * change a cached result for the others, and the size can be trusted for as
+ * long as the mapping is kept.
+ */
+static HRESULT CompilerBlob_CreateShared(ID3DBlob *Source, D3DCOMPILER_BLOB_KIND Kind, ID3DBlob **ppBlob)
+{
+    const char *data = (const char*) ID3D10Blob_GetBufferPointer(Source);
+    SIZE_T Size = ID3D10Blob_GetBufferSize(Source), written;
+    CompilerBlob *blob;
+    ssize_t ret;
+
+    blob = CompilerBlob_Alloc(Size, Kind);
+    if (blob == NULL)
+        return E_OUTOFMEMORY;
+
+    blob->mapped = TRUE;
+    blob->fd = memfd_create("d3dcompiler-blob", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (blob->fd < 0)
+    {
+        free(blob);
+        return E_OUTOFMEMORY;
+    }
+    for (written = 0; written < Size; written += ret)
+    {
+        ret = write(blob->fd, data + written, Size - written);
+        if (ret < 0 && errno == EINTR)
+            ret = 0;
+        else if (ret <= 0)
+            break;
+    }
+    if (written < Size || fcntl(blob->fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    {
+        close(blob->fd);
+        free(blob);
+        return E_OUTOFMEMORY;
+    }
+    if (Size > 0)
+    {
+        blob->blob = mmap(NULL, Size, PROT_READ, MAP_SHARED, blob->fd, 0);
+        if (blob->blob == MAP_FAILED)
+        {
+            close(blob->fd);
+            free(blob);
+            return E_OUTOFMEMORY;
+        }
+    }
 
+    CompilerBlob_Track(blob);
     *ppBlob = (ID3DBlob*) blob;
     return S_OK;
 }
 
+#endif /* D3DCOMPILER_SERVER */
+
+static HRESULT D3DCreateBlob(SIZE_T Size, ID3DBlob **ppBlob)
+{
+    return CompilerBlob_Create(Size, D3DCOMPILER_BLOB_BYTECODE, ppBlob);
+}
+
 #ifdef SPRITEBATCHTEST
 
 /* Fake D3DCompile for SpriteBatchTest */
@@ -502,195 +691,2160 @@ HRESULT WINAPI D3DCompile(
 
 #else
 
-/* Wine's D3DCompile implementation */
+/* Growable Byte Buffer */
 
-static HRESULT hresult_from_vkd3d_result(int vkd3d_result)
+typedef struct Buffer
 {
-    switch (vkd3d_result)
+    char *data;
+    size_t size;
+    size_t capacity;
+    BOOL failed;
+} Buffer;
+
+static void buffer_write(Buffer *buffer, const void *data, size_t size)
+{
+    char *grown;
+    size_t capacity;
+
+    if (buffer->failed)
+        return;
+    if (buffer->size + size > buffer->capacity)
     {
-        case VKD3D_OK:
-            return S_OK;
-        case VKD3D_ERROR_INVALID_SHADER:
-            WARN("Invalid shader bytecode.\n");
-            /* fall-through */
-        case VKD3D_ERROR:
-            return E_FAIL;
-        case VKD3D_ERROR_OUT_OF_MEMORY:
-            return E_OUTOFMEMORY;
-        case VKD3D_ERROR_INVALID_ARGUMENT:
-            return E_INVALIDARG;
-        case VKD3D_ERROR_NOT_IMPLEMENTED:
-            return E_NOTIMPL;
-        default:
-            FIXME("Unhandled vkd3d result %d.\n", vkd3d_result);
-            return E_FAIL;
+        capacity = buffer->capacity ? buffer->capacity : 1024;
+        while (capacity < buffer->size + size)
+            capacity *= 2;
+        grown = (char*) realloc(buffer->data, capacity);
+        if (grown == NULL)
+        {
+            buffer->failed = TRUE;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
     }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
 }
 
-HRESULT WINAPI D3DCompile2(const void *data, SIZE_T data_size, const char *filename,
-        const D3D_SHADER_MACRO *macros, ID3DInclude *include, const char *entry_point,
-        const char *profile, UINT flags, UINT effect_flags, UINT secondary_flags,
-        const void *secondary_data, SIZE_T secondary_data_size, ID3DBlob **shader_blob,
-        ID3DBlob **messages_blob)
+static void buffer_write_u32(Buffer *buffer, uint32_t value)
 {
-#if 0 /* FIXME: Include support */
-    struct d3dcompiler_include_from_file include_from_file;
-#endif
-    struct vkd3d_shader_preprocess_info preprocess_info;
-    struct vkd3d_shader_hlsl_source_info hlsl_info;
-    struct vkd3d_shader_compile_option options[2];
-    struct vkd3d_shader_compile_info compile_info;
-    struct vkd3d_shader_compile_option *option;
-    struct vkd3d_shader_code byte_code;
-    const D3D_SHADER_MACRO *macro;
-    size_t profile_len, i;
-    char *messages;
-    HRESULT hr;
-    int ret;
+    buffer_write(buffer, &value, sizeof(value));
+}
 
-    static const char * const d3dbc_profiles[] =
-    {
-        "fx_2_",
+/* Compile Server Protocol
+ *
+ * When D3DCOMPILER_SERVER names a Unix domain socket, D3DCompile2 forwards
+ * each request to a d3dcompiler-server listening there. The server shares
+ * one cache between every client on the machine and returns its results as
+ * shared memory file descriptors, which the client maps as blobs.
+ *
+ * A request is a ServerRequestHeader followed by `size` bytes of payload:
+ *
+ *   u32 flags, effect_flags, secondary_flags
+ *   str data, filename, entry_point, profile, secondary_data
+ *   u32 macro_count, then str name, str definition for each macro
+ *
+ * where a str is a u32 length followed by that many bytes, or the length
+ * SERVER_NULL_STRING for a NULL pointer. C strings include their terminator.
+ * The reply is a single ServerReply, with the code and messages descriptors
+ * (when present, in that order) attached as SCM_RIGHTS. A server that cannot
+ * serve a request (such as one from another protocol version, or when it runs
+ * out of memory or descriptors) replies SERVER_E_UNSUPPORTED and the client
+ * compiles in-process, so ServerReply must keep its layout across versions.
+ *
+ * Every socket operation is bounded, so that a stalled peer cannot hang the
+ * other side: clients that cannot get a request through in time, or that
+ * wait too long for a reply, compile in-process, and the server drops
+ * clients that stop sending or receiving.
+ */
 
-        "ps.1.",
-        "ps.2.",
-        "ps.3.",
+#define SERVER_MAGIC 0x43443344 /* "D3DC" */
+#define SERVER_VERSION 1
+#define SERVER_MAX_REQUEST (64 * 1024 * 1024)
+#define SERVER_NULL_STRING 0xFFFFFFFF
+#define SERVER_E_UNSUPPORTED ((HRESULT) 0x80070032) /* ERROR_NOT_SUPPORTED */
+#define SERVER_CONNECT_TIMEOUT 2 /* Seconds to connect and send a request */
+#define SERVER_REPLY_TIMEOUT 120 /* Seconds to wait for a compile */
+#define SERVER_CLIENT_TIMEOUT 10 /* Seconds the server waits on a client */
 
-        "ps_1_",
-        "ps_2_",
-        "ps_3_",
+typedef struct ServerRequestHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+} ServerRequestHeader;
 
-        "vs.1.",
-        "vs.2.",
-        "vs.3.",
+typedef struct ServerReply
+{
+    uint32_t magic;
+    int32_t hr;
+    uint32_t has_code;
+    uint32_t has_messages;
+    uint64_t code_size;
+    uint64_t messages_size;
+} ServerReply;
 
-        "vs_1_",
-        "vs_2_",
-        "vs_3_",
+/* Only processes of the same user may serve or request compiles, since
+ * anyone else could hand out arbitrary bytecode or flood the cache
+ */
+static BOOL server_peer_is_trusted(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
 
-        "tx_1_",
-    };
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return FALSE;
+    return cred.uid == geteuid();
+}
 
-    TRACE("data %p, data_size %Iu, filename %s, macros %p, include %p, entry_point %s, "
-            "profile %s, flags %#x, effect_flags %#x, secondary_flags %#x, secondary_data %p, "
-            "secondary_data_size %Iu, shader_blob %p, messages_blob %p.\n",
-            data, data_size, debugstr_a(filename), macros, include, debugstr_a(entry_point),
-            debugstr_a(profile), flags, effect_flags, secondary_flags, secondary_data,
-            secondary_data_size, shader_blob, messages_blob);
+/* Bounds every later send, receive and connect on the socket; once a bound
+ * is hit they fail with EAGAIN/EWOULDBLOCK (EINPROGRESS for connect)
+ */
+static BOOL server_set_timeout(int fd, int seconds)
+{
+    struct timeval timeout;
 
-#if 0 /* FIXME: Include support */
-    if (include == D3D_COMPILE_STANDARD_FILE_INCLUDE)
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = 0;
+    return setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0
+            && setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+static BOOL server_send(int fd, const void *data, size_t size)
+{
+    const char *ptr = (const char*) data;
+    ssize_t ret;
+
+    while (size > 0)
     {
-        include_from_file.ID3DInclude_iface.lpVtbl = &d3dcompiler_include_from_file_vtbl;
-        include = &include_from_file.ID3DInclude_iface;
+        ret = send(fd, ptr, size, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return FALSE;
+        ptr += ret;
+        size -= ret;
     }
-#endif
+    return TRUE;
+}
 
-    if (flags & ~D3DCOMPILE_DEBUG)
-        FIXME("Ignoring flags %#x.\n", flags);
-    if (effect_flags)
-        FIXME("Ignoring effect flags %#x.\n", effect_flags);
-    if (secondary_flags)
-        FIXME("Ignoring secondary flags %#x.\n", secondary_flags);
+static BOOL server_recv(int fd, void *data, size_t size)
+{
+    char *ptr = (char*) data;
+    ssize_t ret;
 
-    if (messages_blob)
-        *messages_blob = NULL;
+    while (size > 0)
+    {
+        ret = recv(fd, ptr, size, 0);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return FALSE;
+        ptr += ret;
+        size -= ret;
+    }
+    return TRUE;
+}
 
-    option = &options[0];
-    option->name = VKD3D_SHADER_COMPILE_OPTION_API_VERSION;
-    option->value = VKD3D_SHADER_API_VERSION_1_3;
+/* Wraps a shared memory segment as a blob without copying it. The mapping is
+ * private, so writes through GetBufferPointer never reach other processes.
+ * The caller keeps ownership of fd, unless it hands it to the blob.
+ *
+ * Touching a mapping past the end of its file raises SIGBUS, so the segment
+ * must be sealed against shrinking and hold at least Size bytes. It must also
+ * be sealed against writes, since other clients share the same segment.
+ */
+static HRESULT D3DCreateBlobFromSharedMemory(
+    int fd,
+    SIZE_T Size,
+    D3DCOMPILER_BLOB_KIND Kind,
+    ID3DBlob **ppBlob
+) {
+    CompilerBlob *blob;
+    struct stat st;
+    int seals;
+
+    if (ppBlob == NULL)
+        return E_INVALIDARG;
 
-    compile_info.type = VKD3D_SHADER_STRUCTURE_TYPE_COMPILE_INFO;
-    compile_info.next = &preprocess_info;
-    compile_info.source.code = data;
-    compile_info.source.size = data_size;
-    compile_info.source_type = VKD3D_SHADER_SOURCE_HLSL;
-    compile_info.target_type = VKD3D_SHADER_TARGET_DXBC_TPF;
-    compile_info.options = options;
-    compile_info.option_count = 1;
-    compile_info.log_level = VKD3D_SHADER_LOG_INFO;
-    compile_info.source_name = filename;
+    seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE)
+            || fstat(fd, &st) < 0
+            || st.st_size < 0 || (uint64_t) st.st_size < Size)
+        return E_FAIL;
 
-    profile_len = strlen(profile);
-    for (i = 0; i < ARRAY_SIZE(d3dbc_profiles); ++i)
-    {
-        size_t len = strlen(d3dbc_profiles[i]);
+    blob = CompilerBlob_Alloc(Size, Kind);
+    if (blob == NULL)
+        return E_OUTOFMEMORY;
 
-        if (len <= profile_len && !memcmp(profile, d3dbc_profiles[i], len))
+    blob->mapped = TRUE;
+    if (Size > 0)
+    {
+        blob->blob = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (blob->blob == MAP_FAILED)
         {
-            compile_info.target_type = VKD3D_SHADER_TARGET_D3D_BYTECODE;
-            break;
+            free(blob);
+            return E_OUTOFMEMORY;
         }
     }
 
-    preprocess_info.type = VKD3D_SHADER_STRUCTURE_TYPE_PREPROCESS_INFO;
-    preprocess_info.next = &hlsl_info;
-    preprocess_info.macros = (const struct vkd3d_shader_macro *)macros;
-    preprocess_info.macro_count = 0;
-    if (macros)
-    {
-        for (macro = macros; macro->Name; ++macro)
-            ++preprocess_info.macro_count;
-    }
-#if 0 /* FIXME: Include support */
-    preprocess_info.pfn_open_include = open_include;
-    preprocess_info.pfn_close_include = close_include;
-    preprocess_info.include_context = include;
-#else
-    preprocess_info.pfn_open_include = NULL;
-    preprocess_info.pfn_close_include = NULL;
-    preprocess_info.include_context = NULL;
-#endif
+    CompilerBlob_Track(blob);
+    *ppBlob = (ID3DBlob*) blob;
+    return S_OK;
+}
 
-    hlsl_info.type = VKD3D_SHADER_STRUCTURE_TYPE_HLSL_SOURCE_INFO;
-    hlsl_info.next = NULL;
-    hlsl_info.profile = profile;
-    hlsl_info.entry_point = entry_point;
-    hlsl_info.secondary_code.code = secondary_data;
-    hlsl_info.secondary_code.size = secondary_data_size;
+/* Receives a reply and its descriptors, which the caller must close even if
+ * the reply turns out to be invalid
+ */
+static BOOL server_recv_reply(int fd, ServerReply *reply, int *fds, int *fd_count)
+{
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t ret;
 
-    if (!(flags & D3DCOMPILE_DEBUG))
-    {
-        option = &options[compile_info.option_count++];
-        option->name = VKD3D_SHADER_COMPILE_OPTION_STRIP_DEBUG;
-        option->value = true;
-    }
+    *fd_count = 0;
+    iov.iov_base = reply;
+    iov.iov_len = sizeof(*reply);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
 
-    ret = vkd3d_shader_compile(&compile_info, &byte_code, &messages);
-    if (messages)
+    do
     {
-        if (messages_blob)
-        {
-            size_t size = strlen(messages);
-            if (FAILED(hr = D3DCreateBlob(size, messages_blob)))
-            {
-                vkd3d_shader_free_messages(messages);
-                vkd3d_shader_free_shader_code(&byte_code);
-                return hr;
-            }
-            memcpy(ID3D10Blob_GetBufferPointer(*messages_blob), messages, size);
-        }
-        else
-            vkd3d_shader_free_messages(messages);
-    }
+        ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0)
+        return FALSE;
 
-    if (!ret)
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
     {
-        if (FAILED(hr = D3DCreateBlob(byte_code.size, shader_blob)))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
         {
-            vkd3d_shader_free_shader_code(&byte_code);
-            return hr;
+            *fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *fd_count);
         }
-        memcpy(ID3D10Blob_GetBufferPointer(*shader_blob), byte_code.code, byte_code.size);
     }
+    if (msg.msg_flags & MSG_CTRUNC)
+        return FALSE;
 
-    return hresult_from_vkd3d_result(ret);
+    /* The descriptors arrive with the first byte; the rest may trail */
+    return server_recv(fd, (char*) reply + ret, sizeof(*reply) - ret)
+            && reply->magic == SERVER_MAGIC
+            && *fd_count == !!reply->has_code + !!reply->has_messages
+            && (FAILED(reply->hr) || reply->has_code);
 }
 
-HRESULT WINAPI D3DCompile(const void *data, SIZE_T data_size, const char *filename,
-        const D3D_SHADER_MACRO *defines, ID3DInclude *include, const char *entrypoint,
-        const char *target, UINT sflags, UINT eflags, ID3DBlob **shader, ID3DBlob **error_messages)
-{
+#ifndef D3DCOMPILER_SERVER
+
+/* Compile Server Client */
+
+static void server_write_data(Buffer *buffer, const void *data, size_t size)
+{
+    if (data == NULL)
+    {
+        buffer_write_u32(buffer, SERVER_NULL_STRING);
+        return;
+    }
+    if (size >= SERVER_NULL_STRING)
+    {
+        buffer->failed = TRUE;
+        return;
+    }
+    buffer_write_u32(buffer, size);
+    buffer_write(buffer, data, size);
+}
+
+static void server_write_string(Buffer *buffer, const char *str)
+{
+    server_write_data(buffer, str, str ? strlen(str) + 1 : 0);
+}
+
+static int server_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (!server_set_timeout(fd, SERVER_CONNECT_TIMEOUT)
+            || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+            || !server_peer_is_trusted(fd))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Returns FALSE if the request should be compiled in-process instead, either
+ * because no server is configured or because it could not be reached in time.
+ * Once a request has been sent the server's answer is final, unless it never
+ * arrives (the server died, or took longer than SERVER_REPLY_TIMEOUT), in
+ * which case it is retried here. Shaders that crash the compiler are failed
+ * by the server itself, since it compiles each of them in a child process.
+ */
+static BOOL server_compile(const void *data, SIZE_T data_size, const char *filename,
+        const D3D_SHADER_MACRO *macros, const char *entry_point, const char *profile,
+        UINT flags, UINT effect_flags, UINT secondary_flags, const void *secondary_data,
+        SIZE_T secondary_data_size, ID3DBlob **shader_blob, ID3DBlob **messages_blob,
+        HRESULT *hr)
+{
+    ServerRequestHeader header;
+    Buffer request;
+    ServerReply reply;
+    const D3D_SHADER_MACRO *macro;
+    const char *path;
+    uint32_t macro_count, m;
+    int fds[2], fd_count, fd, i;
+    HRESULT blob_hr;
+    BOOL valid;
+
+    path = getenv("D3DCOMPILER_SERVER");
+    if (path == NULL || *path == '\0')
+        return FALSE;
+
+    memset(&request, 0, sizeof(request));
+    buffer_write_u32(&request, flags);
+    buffer_write_u32(&request, effect_flags);
+    buffer_write_u32(&request, secondary_flags);
+    server_write_data(&request, data, data_size);
+    server_write_string(&request, filename);
+    server_write_string(&request, entry_point);
+    server_write_string(&request, profile);
+    server_write_data(&request, secondary_data, secondary_data_size);
+    macro_count = 0;
+    if (macros)
+    {
+        for (macro = macros; macro->Name; ++macro)
+            ++macro_count;
+    }
+    buffer_write_u32(&request, macro_count);
+    for (m = 0; m < macro_count; ++m)
+    {
+        server_write_string(&request, macros[m].Name);
+        server_write_string(&request, macros[m].Definition);
+    }
+    if (request.failed || request.size > SERVER_MAX_REQUEST)
+    {
+        free(request.data);
+        return FALSE;
+    }
+
+    fd = server_connect(path);
+    if (fd < 0)
+    {
+        free(request.data);
+        return FALSE;
+    }
+
+    header.magic = SERVER_MAGIC;
+    header.version = SERVER_VERSION;
+    header.size = request.size;
+    valid = server_send(fd, &header, sizeof(header))
+            && server_send(fd, request.data, request.size)
+            && server_set_timeout(fd, SERVER_REPLY_TIMEOUT);
+    free(request.data);
+    if (!valid)
+    {
+        close(fd);
+        return FALSE;
+    }
+
+    valid = server_recv_reply(fd, &reply, fds, &fd_count);
+    close(fd);
+    if (!valid || reply.hr == SERVER_E_UNSUPPORTED)
+    {
+        for (i = 0; i < fd_count; ++i)
+            close(fds[i]);
+        return FALSE;
+    }
+
+    /* Same order as the in-process path: messages first, then code */
+    blob_hr = S_OK;
+    if (messages_blob)
+        *messages_blob = NULL;
+    if (reply.has_messages && messages_blob)
+        blob_hr = D3DCreateBlobFromSharedMemory(fds[fd_count - 1], reply.messages_size,
+                D3DCOMPILER_BLOB_MESSAGES, messages_blob);
+    if (reply.has_code && SUCCEEDED(blob_hr))
+        blob_hr = D3DCreateBlobFromSharedMemory(fds[0], reply.code_size,
+                D3DCOMPILER_BLOB_BYTECODE, shader_blob);
+    for (i = 0; i < fd_count; ++i)
+        close(fds[i]);
+
+    *hr = FAILED(blob_hr) ? blob_hr : reply.hr;
+    return TRUE;
+}
+
+#endif /* D3DCOMPILER_SERVER */
+
+/* Compile Setup */
+
+/* Fills in the options shared by every HLSL compile and preprocess; callers
+ * chain any further info after preprocess_info and adjust the target type.
+ */
+static void compile_info_init(struct vkd3d_shader_compile_info *compile_info,
+        struct vkd3d_shader_preprocess_info *preprocess_info,
+        struct vkd3d_shader_compile_option *option, const void *data, SIZE_T data_size,
+        const char *filename, const D3D_SHADER_MACRO *macros)
+{
+    const D3D_SHADER_MACRO *macro;
+
+    option->name = VKD3D_SHADER_COMPILE_OPTION_API_VERSION;
+    option->value = VKD3D_SHADER_API_VERSION_1_3;
+
+    compile_info->type = VKD3D_SHADER_STRUCTURE_TYPE_COMPILE_INFO;
+    compile_info->next = preprocess_info;
+    compile_info->source.code = data;
+    compile_info->source.size = data_size;
+    compile_info->source_type = VKD3D_SHADER_SOURCE_HLSL;
+    compile_info->target_type = VKD3D_SHADER_TARGET_DXBC_TPF;
+    compile_info->options = option;
+    compile_info->option_count = 1;
+    compile_info->log_level = VKD3D_SHADER_LOG_INFO;
+    compile_info->source_name = filename;
+
+    preprocess_info->type = VKD3D_SHADER_STRUCTURE_TYPE_PREPROCESS_INFO;
+    preprocess_info->next = NULL;
+    preprocess_info->macros = (const struct vkd3d_shader_macro *)macros;
+    preprocess_info->macro_count = 0;
+    if (macros)
+    {
+        for (macro = macros; macro->Name; ++macro)
+            ++preprocess_info->macro_count;
+    }
+    preprocess_info->pfn_open_include = NULL;
+    preprocess_info->pfn_close_include = NULL;
+    preprocess_info->include_context = NULL;
+}
+
+/* Effect Compilation
+ *
+ * fx_2_ effects are split into their techniques and passes here instead of
+ * being handed to vkd3d whole. Every distinct shader compiled by a pass is
+ * compiled separately, all of them concurrently on a pool of threads shared
+ * by every effect in the process, and the results are assembled into an
+ * fx_2_0 effect binary. The parameter table is built from
+ * the global variable declarations, with their semantics and with their
+ * initializers as default values; sampler_state blocks become the states of
+ * their sampler.
+ *
+ * Effects that use anything else (annotations, render states, sampler states
+ * other than Texture and literals, texture initializers, shader arrays,
+ * string or struct parameters, #pragma pack_matrix...) are left to vkd3d as
+ * before.
+ */
+
+#define EFFECT_FX_2_0_TAG 0xFEFF0901
+#define EFFECT_MAX_THREADS 64
+
+#define EFFECT_STATE_VERTEXSHADER 146
+#define EFFECT_STATE_PIXELSHADER 147
+#define EFFECT_STATE_TEXTURE 164
+
+/* D3DXPARAMETER_CLASS */
+#define EFFECT_CLASS_SCALAR 0
+#define EFFECT_CLASS_VECTOR 1
+#define EFFECT_CLASS_MATRIX_ROWS 2
+#define EFFECT_CLASS_MATRIX_COLUMNS 3
+#define EFFECT_CLASS_OBJECT 4
+
+/* D3DXPARAMETER_TYPE */
+#define EFFECT_TYPE_BOOL 1
+#define EFFECT_TYPE_INT 2
+#define EFFECT_TYPE_FLOAT 3
+#define EFFECT_TYPE_TEXTURE 5
+#define EFFECT_TYPE_SAMPLER 10
+#define EFFECT_TYPE_PIXELSHADER 15
+#define EFFECT_TYPE_VERTEXSHADER 16
+
+#define EFFECT_PARAMETER_SHARED 1 /* D3DX_PARAMETER_SHARED */
+
+typedef struct EffectShader
+{
+    char *profile;
+    char *entry_point;
+    UINT type; /* EFFECT_TYPE_VERTEXSHADER or EFFECT_TYPE_PIXELSHADER */
+    HRESULT hr;
+    ID3DBlob *code;
+    ID3DBlob *messages;
+
+    /* The first state to use this shader owns its large object */
+    size_t technique;
+    size_t pass;
+    size_t state;
+} EffectShader;
+
+typedef struct EffectPass
+{
+    char *name;
+    size_t first_state;
+    size_t state_count;
+} EffectPass;
+
+typedef struct EffectTechnique
+{
+    char *name;
+    size_t first_pass;
+    size_t pass_count;
+} EffectTechnique;
+
+typedef struct EffectSamplerState
+{
+    UINT operation;
+    UINT type; /* EFFECT_TYPE_INT or EFFECT_TYPE_FLOAT, or the texture's type */
+    uint32_t value;
+    char *texture; /* The texture parameter given to Texture, else NULL */
+} EffectSamplerState;
+
+typedef struct EffectParameter
+{
+    char *name;
+    char *semantic;
+    UINT class;
+    UINT type;
+    UINT rows;
+    UINT columns;
+    UINT elements;
+    UINT flags;
+    uint32_t *values; /* rows * columns per element, or NULL for zeroes */
+    EffectSamplerState *states; /* From sampler_state, for single samplers */
+    size_t state_count, state_capacity;
+} EffectParameter;
+
+typedef struct Effect
+{
+    /* The preprocessed source, with the technique blocks blanked out */
+    char *source;
+    size_t source_size;
+    const char *filename;
+    UINT flags;
+
+    EffectTechnique *techniques;
+    size_t technique_count, technique_capacity;
+    EffectPass *passes;
+    size_t pass_count, pass_capacity;
+    size_t *states; /* Index into shaders */
+    size_t state_count, state_capacity;
+    EffectShader *shaders;
+    size_t shader_count, shader_capacity;
+    EffectParameter *parameters;
+    size_t parameter_count, parameter_capacity;
+
+    /* Protected by effect_pool_lock */
+    struct Effect *next_queued;
+    size_t next_shader;
+    size_t finished_shaders;
+} Effect;
+
+typedef struct EffectLexer
+{
+    const char *text;
+    size_t size;
+    size_t offset;
+    const char *token;
+    size_t token_size;
+} EffectLexer;
+
+HRESULT WINAPI D3DCompile2(const void *data, SIZE_T data_size, const char *filename,
+        const D3D_SHADER_MACRO *macros, ID3DInclude *include, const char *entry_point,
+        const char *profile, UINT flags, UINT effect_flags, UINT secondary_flags,
+        const void *secondary_data, SIZE_T secondary_data_size, ID3DBlob **shader_blob,
+        ID3DBlob **messages_blob);
+
+static BOOL effect_array_reserve(void **elements, size_t *capacity, size_t count, size_t size)
+{
+    size_t new_capacity;
+    void *new_elements;
+
+    if (count <= *capacity)
+        return TRUE;
+    new_capacity = *capacity ? *capacity * 2 : 8;
+    if (new_capacity < count)
+        new_capacity = count;
+    new_elements = realloc(*elements, new_capacity * size);
+    if (new_elements == NULL)
+        return FALSE;
+    *elements = new_elements;
+    *capacity = new_capacity;
+    return TRUE;
+}
+
+/* Lexer */
+
+static BOOL effect_is_ident(char c, BOOL first)
+{
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+            || (!first && c >= '0' && c <= '9');
+}
+
+static BOOL effect_lex(EffectLexer *lexer)
+{
+    const char *text = lexer->text;
+    size_t size = lexer->size;
+    size_t i = lexer->offset;
+    size_t start;
+    BOOL hex;
+
+    for (;;)
+    {
+        while (i < size && (text[i] == ' ' || (text[i] >= '\t' && text[i] <= '\r')))
+            ++i;
+        if (i + 1 < size && text[i] == '/' && text[i + 1] == '*')
+        {
+            for (i += 2; i + 1 < size && !(text[i] == '*' && text[i + 1] == '/'); ++i);
+            i = (i + 1 < size) ? i + 2 : size;
+        }
+        else if ((i + 1 < size && text[i] == '/' && text[i + 1] == '/')
+                || (i < size && text[i] == '#')) /* #line from the preprocessor */
+        {
+            while (i < size && text[i] != '\n')
+                ++i;
+        }
+        else
+            break;
+    }
+
+    lexer->offset = i;
+    lexer->token = text + i;
+    lexer->token_size = 0;
+    if (i >= size)
+        return FALSE;
+
+    start = i;
+    if ((text[i] >= '0' && text[i] <= '9')
+            || (text[i] == '.' && i + 1 < size && text[i + 1] >= '0' && text[i + 1] <= '9'))
+    {
+        /* Exponent signs belong to the number, but hex digits have no exponent */
+        hex = (i + 1 < size && text[i] == '0' && (text[i + 1] == 'x' || text[i + 1] == 'X'));
+        for (++i; i < size; ++i)
+        {
+            if ((text[i] == '+' || text[i] == '-') && !hex
+                    && (text[i - 1] == 'e' || text[i - 1] == 'E'))
+                continue;
+            if (!effect_is_ident(text[i], FALSE) && text[i] != '.')
+                break;
+        }
+    }
+    else if (effect_is_ident(text[i], TRUE))
+    {
+        while (i < size && effect_is_ident(text[i], FALSE))
+            ++i;
+    }
+    else if (text[i] == '"')
+    {
+        for (++i; i < size && text[i] != '"'; ++i)
+        {
+            if (text[i] == '\\')
+                ++i;
+        }
+        i = (i < size) ? i + 1 : size;
+    }
+    else
+        ++i;
+
+    lexer->token = text + start;
+    lexer->token_size = i - start;
+    lexer->offset = i;
+    return TRUE;
+}
+
+static BOOL effect_token_is(const EffectLexer *lexer, const char *str)
+{
+    size_t len = strlen(str);
+    return lexer->token_size == len && !memcmp(lexer->token, str, len);
+}
+
+static BOOL effect_token_is_nocase(const EffectLexer *lexer, const char *str)
+{
+    size_t len = strlen(str);
+    return lexer->token_size == len && !strncasecmp(lexer->token, str, len);
+}
+
+static BOOL effect_token_is_ident(const EffectLexer *lexer)
+{
+    return lexer->token_size > 0 && effect_is_ident(lexer->token[0], TRUE);
+}
+
+static locale_t effect_c_locale;
+static pthread_once_t effect_c_locale_once = PTHREAD_ONCE_INIT;
+
+static void effect_c_locale_init(void)
+{
+    effect_c_locale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+}
+
+/* Literals are read in the C locale, whatever the application has set */
+static BOOL effect_token_number(const EffectLexer *lexer, double *value)
+{
+    char buffer[64], *end;
+    size_t size = lexer->token_size;
+    BOOL hex;
+
+    if (size == 0 || size >= sizeof(buffer) || !(lexer->token[0] == '.'
+            || (lexer->token[0] >= '0' && lexer->token[0] <= '9')))
+        return FALSE;
+    memcpy(buffer, lexer->token, size);
+    hex = (size > 1 && (buffer[1] == 'x' || buffer[1] == 'X'));
+    while (size > 1 && strchr(hex ? "lLuU" : "fFhHlLuU", buffer[size - 1]) != NULL)
+        --size;
+    buffer[size] = '\0';
+
+    if (hex || strpbrk(buffer, ".eE") == NULL)
+        *value = (double) strtoul(buffer, &end, 0);
+    else
+    {
+        pthread_once(&effect_c_locale_once, effect_c_locale_init);
+        if (effect_c_locale == (locale_t) 0)
+            return FALSE;
+        *value = strtod_l(buffer, &end, effect_c_locale);
+    }
+    return *end == '\0';
+}
+
+static BOOL effect_token_count(const EffectLexer *lexer, UINT max, UINT *count)
+{
+    double value;
+
+    if (!effect_token_number(lexer, &value) || value < 1 || value > max
+            || value != (UINT) value)
+        return FALSE;
+    *count = (UINT) value;
+    return TRUE;
+}
+
+static char* effect_token_dup(const EffectLexer *lexer)
+{
+    char *str = (char*) malloc(lexer->token_size + 1);
+    if (str != NULL)
+    {
+        memcpy(str, lexer->token, lexer->token_size);
+        str[lexer->token_size] = '\0';
+    }
+    return str;
+}
+
+/* Parser
+ *
+ * All of these return FALSE when the effect cannot be split, including when
+ * memory runs out; the effect then goes to vkd3d, which reports any errors.
+ */
+
+static BOOL effect_parse_state(Effect *effect, EffectLexer *lexer)
+{
+    EffectShader *shader;
+    const char *profile, *entry_point;
+    size_t profile_size, entry_point_size, i;
+    UINT type;
+
+    if (effect_token_is_nocase(lexer, "VertexShader"))
+        type = EFFECT_TYPE_VERTEXSHADER;
+    else if (effect_token_is_nocase(lexer, "PixelShader"))
+        type = EFFECT_TYPE_PIXELSHADER;
+    else
+        return FALSE;
+
+    if (!effect_lex(lexer) || !effect_token_is(lexer, "="))
+        return FALSE;
+    if (!effect_lex(lexer) || !effect_token_is(lexer, "compile"))
+        return FALSE;
+
+    /* Only shader model 1-3 profiles fit in an fx_2_0 effect */
+    if (!effect_lex(lexer) || lexer->token_size < 4)
+        return FALSE;
+    profile = lexer->token;
+    profile_size = lexer->token_size;
+    if (memcmp(profile, (type == EFFECT_TYPE_VERTEXSHADER) ? "vs_" : "ps_", 3) != 0
+            || profile[3] < '1' || profile[3] > '3')
+        return FALSE;
+
+    /* Uniform arguments to the entry point are not supported */
+    if (!effect_lex(lexer) || !effect_token_is_ident(lexer))
+        return FALSE;
+    entry_point = lexer->token;
+    entry_point_size = lexer->token_size;
+    if (!effect_lex(lexer) || !effect_token_is(lexer, "("))
+        return FALSE;
+    if (!effect_lex(lexer) || !effect_token_is(lexer, ")"))
+        return FALSE;
+    if (!effect_lex(lexer) || !effect_token_is(lexer, ";"))
+        return FALSE;
+
+    for (i = 0; i < effect->shader_count; ++i)
+    {
+        shader = &effect->shaders[i];
+        if (strlen(shader->profile) == profile_size
+                && !memcmp(shader->profile, profile, profile_size)
+                && strlen(shader->entry_point) == entry_point_size
+                && !memcmp(shader->entry_point, entry_point, entry_point_size))
+            break;
+    }
+    if (i == effect->shader_count)
+    {
+        if (!effect_array_reserve((void**) &effect->shaders, &effect->shader_capacity,
+                effect->shader_count + 1, sizeof(*effect->shaders)))
+            return FALSE;
+        shader = &effect->shaders[effect->shader_count];
+        memset(shader, 0, sizeof(*shader));
+        shader->profile = (char*) malloc(profile_size + 1);
+        shader->entry_point = (char*) malloc(entry_point_size + 1);
+        effect->shader_count += 1;
+        if (shader->profile == NULL || shader->entry_point == NULL)
+            return FALSE;
+        memcpy(shader->profile, profile, profile_size);
+        shader->profile[profile_size] = '\0';
+        memcpy(shader->entry_point, entry_point, entry_point_size);
+        shader->entry_point[entry_point_size] = '\0';
+        shader->type = type;
+        shader->technique = effect->technique_count - 1;
+        shader->pass = effect->pass_count - 1 - effect->techniques[shader->technique].first_pass;
+        shader->state = effect->state_count - effect->passes[effect->pass_count - 1].first_state;
+    }
+
+    if (!effect_array_reserve((void**) &effect->states, &effect->state_capacity,
+            effect->state_count + 1, sizeof(*effect->states)))
+        return FALSE;
+    effect->states[effect->state_count++] = i;
+    return TRUE;
+}
+
+static BOOL effect_parse_pass(Effect *effect, EffectLexer *lexer)
+{
+    EffectPass *pass;
+
+    if (!effect_array_reserve((void**) &effect->passes, &effect->pass_capacity,
+            effect->pass_count + 1, sizeof(*effect->passes)))
+        return FALSE;
+    pass = &effect->passes[effect->pass_count++];
+    pass->name = NULL;
+    pass->first_state = effect->state_count;
+    pass->state_count = 0;
+
+    if (!effect_lex(lexer))
+        return FALSE;
+    if (effect_token_is_ident(lexer))
+    {
+        if ((pass->name = effect_token_dup(lexer)) == NULL)
+            return FALSE;
+        if (!effect_lex(lexer))
+            return FALSE;
+    }
+    if (!effect_token_is(lexer, "{"))
+        return FALSE;
+
+    for (;;)
+    {
+        if (!effect_lex(lexer))
+            return FALSE;
+        if (effect_token_is(lexer, "}"))
+            break;
+        if (!effect_parse_state(effect, lexer))
+            return FALSE;
+    }
+
+    pass = &effect->passes[effect->pass_count - 1];
+    pass->state_count = effect->state_count - pass->first_state;
+    return TRUE;
+}
+
+static BOOL effect_parse_technique(Effect *effect, EffectLexer *lexer)
+{
+    EffectTechnique *technique;
+
+    if (!effect_array_reserve((void**) &effect->techniques, &effect->technique_capacity,
+            effect->technique_count + 1, sizeof(*effect->techniques)))
+        return FALSE;
+    technique = &effect->techniques[effect->technique_count++];
+    technique->name = NULL;
+    technique->first_pass = effect->pass_count;
+    technique->pass_count = 0;
+
+    if (!effect_lex(lexer))
+        return FALSE;
+    if (effect_token_is_ident(lexer))
+    {
+        if ((technique->name = effect_token_dup(lexer)) == NULL)
+            return FALSE;
+        if (!effect_lex(lexer))
+            return FALSE;
+    }
+    if (!effect_token_is(lexer, "{"))
+        return FALSE;
+
+    for (;;)
+    {
+        if (!effect_lex(lexer))
+            return FALSE;
+        if (effect_token_is(lexer, "}"))
+            break;
+        if (!effect_token_is(lexer, "pass") || !effect_parse_pass(effect, lexer))
+            return FALSE;
+    }
+
+    technique->pass_count = effect->pass_count - technique->first_pass;
+    return TRUE;
+}
+
+/* Leaves the lexer on the bracket that closes the one it is on */
+static BOOL effect_skip_block(EffectLexer *lexer, const char *open, const char *close)
+{
+    size_t depth = 0;
+
+    do
+    {
+        if (effect_token_is(lexer, open))
+            depth += 1;
+        else if (effect_token_is(lexer, close) && --depth == 0)
+            return TRUE;
+    } while (effect_lex(lexer));
+    return FALSE;
+}
+
+/* Struct definitions are only needed by the shaders, but variables of
+ * struct type would need their members in the parameter table.
+ */
+static BOOL effect_parse_struct(EffectLexer *lexer)
+{
+    if (!effect_lex(lexer))
+        return FALSE;
+    if (effect_token_is_ident(lexer) && !effect_lex(lexer))
+        return FALSE;
+    if (!effect_token_is(lexer, "{") || !effect_skip_block(lexer, "{", "}"))
+        return FALSE;
+    return effect_lex(lexer) && effect_token_is(lexer, ";");
+}
+
+/* Function definitions are only needed by the shaders */
+static BOOL effect_parse_function(EffectLexer *lexer)
+{
+    if (!effect_skip_block(lexer, "(", ")") || !effect_lex(lexer))
+        return FALSE;
+    if (effect_token_is(lexer, ":"))
+    {
+        if (!effect_lex(lexer) || !effect_token_is_ident(lexer) || !effect_lex(lexer))
+            return FALSE;
+    }
+    if (effect_token_is(lexer, ";"))
+        return TRUE;
+    return effect_token_is(lexer, "{") && effect_skip_block(lexer, "{", "}");
+}
+
+static BOOL effect_numeric_type(const EffectLexer *lexer, EffectParameter *parameter)
+{
+    static const struct
+    {
+        const char *name;
+        UINT type;
+    } types[] =
+    {
+        { "bool", EFFECT_TYPE_BOOL },
+        { "int", EFFECT_TYPE_INT },
+        { "half", EFFECT_TYPE_FLOAT },
+        { "float", EFFECT_TYPE_FLOAT },
+    };
+    const char *dims;
+    size_t len, i;
+
+    for (i = 0; i < ARRAY_SIZE(types); ++i)
+    {
+        len = strlen(types[i].name);
+        if (lexer->token_size < len || memcmp(lexer->token, types[i].name, len))
+            continue;
+        dims = lexer->token + len;
+        len = lexer->token_size - len;
+
+        parameter->type = types[i].type;
+        if (len == 0)
+        {
+            parameter->class = EFFECT_CLASS_SCALAR;
+            parameter->rows = 1;
+            parameter->columns = 1;
+            return TRUE;
+        }
+        if (len == 1 && dims[0] >= '1' && dims[0] <= '4')
+        {
+            parameter->class = EFFECT_CLASS_VECTOR;
+            parameter->rows = 1;
+            parameter->columns = dims[0] - '0';
+            return TRUE;
+        }
+        if (len == 3 && dims[0] >= '1' && dims[0] <= '4' && dims[1] == 'x'
+                && dims[2] >= '1' && dims[2] <= '4')
+        {
+            parameter->class = EFFECT_CLASS_MATRIX_COLUMNS;
+            parameter->rows = dims[0] - '0';
+            parameter->columns = dims[2] - '0';
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Reads the type that starts at the current token, and leaves the lexer on
+ * its last token. Returns FALSE for types that cannot be parameters.
+ */
+static BOOL effect_parse_type(EffectLexer *lexer, EffectParameter *parameter)
+{
+    static const char * const object_types[] =
+    {
+        "texture", "texture1D", "texture2D", "texture3D", "textureCUBE",
+        "sampler", "sampler1D", "sampler2D", "sampler3D", "samplerCUBE",
+    };
+    EffectParameter scalar;
+    EffectLexer peek;
+    BOOL matrix;
+    UINT i;
+
+    for (i = 0; i < ARRAY_SIZE(object_types); ++i)
+    {
+        if (effect_token_is_nocase(lexer, object_types[i]))
+        {
+            parameter->class = EFFECT_CLASS_OBJECT;
+            parameter->type = EFFECT_TYPE_TEXTURE + i;
+            return TRUE;
+        }
+    }
+    if (effect_numeric_type(lexer, parameter))
+        return TRUE;
+
+    /* matrix and vector are float4x4 and float4 unless given as templates */
+    matrix = effect_token_is(lexer, "matrix");
+    if (!matrix && !effect_token_is(lexer, "vector"))
+        return FALSE;
+    parameter->type = EFFECT_TYPE_FLOAT;
+    parameter->class = matrix ? EFFECT_CLASS_MATRIX_COLUMNS : EFFECT_CLASS_VECTOR;
+    parameter->rows = matrix ? 4 : 1;
+    parameter->columns = 4;
+
+    peek = *lexer;
+    if (!effect_lex(&peek) || !effect_token_is(&peek, "<"))
+        return TRUE;
+    *lexer = peek;
+    if (!effect_lex(lexer) || !effect_numeric_type(lexer, &scalar)
+            || scalar.class != EFFECT_CLASS_SCALAR)
+        return FALSE;
+    parameter->type = scalar.type;
+    if (matrix)
+    {
+        if (!effect_lex(lexer) || !effect_token_is(lexer, ",")
+                || !effect_lex(lexer) || !effect_token_count(lexer, 4, &parameter->rows))
+            return FALSE;
+    }
+    if (!effect_lex(lexer) || !effect_token_is(lexer, ",")
+            || !effect_lex(lexer) || !effect_token_count(lexer, 4, &parameter->columns))
+        return FALSE;
+    return effect_lex(lexer) && effect_token_is(lexer, ">");
+}
+
+/* Flattens an initializer of literals, constructors and braces into values
+ * of the parameter's type, where a single scalar is given to every component.
+ * Leaves the lexer on the ',' or ';' that ends it.
+ */
+static BOOL effect_parse_initializer(EffectLexer *lexer, EffectParameter *parameter)
+{
+    size_t count = 0, total, depth = 0, i;
+    EffectParameter constructor;
+    double value, sign = 1.0;
+    BOOL operand = TRUE;
+    float f;
+
+    total = parameter->rows * parameter->columns * (parameter->elements ? parameter->elements : 1);
+    parameter->values = (uint32_t*) calloc(total, sizeof(*parameter->values));
+    if (parameter->values == NULL)
+        return FALSE;
+
+    while (effect_lex(lexer))
+    {
+        if (effect_token_is(lexer, "(") || effect_token_is(lexer, "{"))
+        {
+            depth += 1;
+            operand = TRUE;
+            continue;
+        }
+        if (effect_token_is(lexer, ")") || effect_token_is(lexer, "}"))
+        {
+            if (depth == 0)
+                return FALSE;
+            depth -= 1;
+            continue;
+        }
+        if (effect_token_is(lexer, ",") || effect_token_is(lexer, ";"))
+        {
+            if (depth > 0 && effect_token_is(lexer, ","))
+            {
+                operand = TRUE;
+                continue;
+            }
+            if (depth > 0 || count == 0 || (count != 1 && count != total))
+                return FALSE;
+            for (i = 1; count == 1 && i < total; ++i)
+                parameter->values[i] = parameter->values[0];
+            return TRUE;
+        }
+
+        /* Anything but a literal, a sign or a constructor is an expression */
+        if (!operand)
+            return FALSE;
+        if (effect_token_is(lexer, "-") || effect_token_is(lexer, "+"))
+        {
+            if (effect_token_is(lexer, "-"))
+                sign = -sign;
+            continue;
+        }
+        if (effect_numeric_type(lexer, &constructor))
+            continue;
+
+        if (effect_token_is(lexer, "true"))
+            value = 1.0;
+        else if (effect_token_is(lexer, "false"))
+            value = 0.0;
+        else if (!effect_token_number(lexer, &value))
+            return FALSE;
+        if (count == total)
+            return FALSE;
+        value *= sign;
+        sign = 1.0;
+        operand = FALSE;
+
+        if (parameter->type == EFFECT_TYPE_FLOAT)
+        {
+            f = (float) value;
+            memcpy(&parameter->values[count], &f, sizeof(f));
+        }
+        else if (parameter->type == EFFECT_TYPE_INT)
+            parameter->values[count] = (uint32_t) (int32_t) value;
+        else
+            parameter->values[count] = (value != 0.0);
+        count += 1;
+    }
+    return FALSE;
+}
+
+/* Reads the texture parameter given to a Texture state, as (Name), <Name> or
+ * Name, which the sampler refers to by name
+ */
+static BOOL effect_parse_texture_reference(Effect *effect, EffectLexer *lexer,
+        EffectSamplerState *state)
+{
+    const EffectParameter *texture;
+    const char *close = NULL;
+    size_t i;
+
+    if (effect_token_is(lexer, "("))
+        close = ")";
+    else if (effect_token_is(lexer, "<"))
+        close = ">";
+    if (close != NULL && !effect_lex(lexer))
+        return FALSE;
+    if (!effect_token_is_ident(lexer))
+        return FALSE;
+
+    for (i = 0; i < effect->parameter_count; ++i)
+    {
+        texture = &effect->parameters[i];
+        if (texture->class == EFFECT_CLASS_OBJECT && texture->type < EFFECT_TYPE_SAMPLER
+                && texture->elements == 0 && strlen(texture->name) == lexer->token_size
+                && !memcmp(texture->name, lexer->token, lexer->token_size))
+            break;
+    }
+    if (i == effect->parameter_count)
+        return FALSE;
+    state->type = texture->type;
+    if ((state->texture = effect_token_dup(lexer)) == NULL)
+        return FALSE;
+
+    return close == NULL || (effect_lex(lexer) && effect_token_is(lexer, close));
+}
+
+/* Reads a literal, or the name of one of values, as the state's value */
+static BOOL effect_parse_state_value(EffectLexer *lexer, const char * const *values,
+        EffectSamplerState *state)
+{
+    double value, sign = 1.0;
+    float f;
+    size_t i;
+
+    if (effect_token_is(lexer, "-"))
+    {
+        sign = -1.0;
+        if (!effect_lex(lexer))
+            return FALSE;
+    }
+
+    for (i = 0; values != NULL && values[i] != NULL; ++i)
+    {
+        if (effect_token_is_nocase(lexer, values[i]))
+            break;
+    }
+    if (values != NULL && values[i] != NULL)
+        value = (double) i;
+    else if (effect_token_is(lexer, "true"))
+        value = 1.0;
+    else if (effect_token_is(lexer, "false"))
+        value = 0.0;
+    else if (!effect_token_number(lexer, &value))
+        return FALSE;
+    value *= sign;
+
+    if (state->type == EFFECT_TYPE_FLOAT)
+    {
+        f = (float) value;
+        memcpy(&state->value, &f, sizeof(f));
+    }
+    else
+        state->value = (uint32_t) (int32_t) value;
+    return TRUE;
+}
+
+/* Reads a sampler_state block starting at its '=', and blanks it out of the
+ * source for the shaders. Leaves the lexer on the ',' or ';' that ends it.
+ */
+static BOOL effect_parse_sampler_state(Effect *effect, EffectLexer *lexer,
+        EffectParameter *parameter)
+{
+    /* D3DTEXTUREADDRESS and D3DTEXTUREFILTERTYPE, by value */
+    static const char * const address_values[] =
+    {
+        "", "Wrap", "Mirror", "Clamp", "Border", "MirrorOnce", NULL
+    };
+    static const char * const filter_values[] =
+    {
+        "None", "Point", "Linear", "Anisotropic", "", "", "PyramidalQuad", "GaussianQuad",
+        "ConvolutionMono", NULL
+    };
+    static const struct
+    {
+        const char *name;
+        UINT operation;
+        UINT type;
+        const char * const *values;
+    } states[] =
+    {
+        { "Texture", EFFECT_STATE_TEXTURE, EFFECT_TYPE_TEXTURE, NULL },
+        { "AddressU", 165, EFFECT_TYPE_INT, address_values },
+        { "AddressV", 166, EFFECT_TYPE_INT, address_values },
+        { "AddressW", 167, EFFECT_TYPE_INT, address_values },
+        { "BorderColor", 168, EFFECT_TYPE_INT, NULL },
+        { "MagFilter", 169, EFFECT_TYPE_INT, filter_values },
+        { "MinFilter", 170, EFFECT_TYPE_INT, filter_values },
+        { "MipFilter", 171, EFFECT_TYPE_INT, filter_values },
+        { "MipMapLodBias", 172, EFFECT_TYPE_FLOAT, NULL },
+        { "MaxMipLevel", 173, EFFECT_TYPE_INT, NULL },
+        { "MaxAnisotropy", 174, EFFECT_TYPE_INT, NULL },
+        { "SRGBTexture", 175, EFFECT_TYPE_INT, NULL },
+    };
+    EffectSamplerState *state;
+    size_t start, i;
+
+    start = lexer->token - lexer->text;
+    if (!effect_lex(lexer) || !effect_token_is(lexer, "sampler_state"))
+        return FALSE;
+    if (!effect_lex(lexer) || !effect_token_is(lexer, "{"))
+        return FALSE;
+
+    for (;;)
+    {
+        if (!effect_lex(lexer))
+            return FALSE;
+        if (effect_token_is(lexer, "}"))
+            break;
+
+        for (i = 0; i < ARRAY_SIZE(states); ++i)
+        {
+            if (effect_token_is_nocase(lexer, states[i].name))
+                break;
+        }
+        if (i == ARRAY_SIZE(states))
+            return FALSE;
+        if (!effect_lex(lexer) || !effect_token_is(lexer, "=") || !effect_lex(lexer))
+            return FALSE;
+
+        if (!effect_array_reserve((void**) &parameter->states, &parameter->state_capacity,
+                parameter->state_count + 1, sizeof(*parameter->states)))
+            return FALSE;
+        state = &parameter->states[parameter->state_count++];
+        memset(state, 0, sizeof(*state));
+        state->operation = states[i].operation;
+        state->type = states[i].type;
+        if (states[i].operation == EFFECT_STATE_TEXTURE)
+        {
+            if (!effect_parse_texture_reference(effect, lexer, state))
+                return FALSE;
+        }
+        else if (!effect_parse_state_value(lexer, states[i].values, state))
+            return FALSE;
+
+        if (!effect_lex(lexer) || !effect_token_is(lexer, ";"))
+            return FALSE;
+    }
+
+    /* Keep the line numbers intact for the per-shader messages */
+    for (i = start; i < lexer->offset; ++i)
+    {
+        if (effect->source[i] != '\n')
+            effect->source[i] = ' ';
+    }
+    return effect_lex(lexer);
+}
+
+/* Reads a global declaration starting at its first token. Functions are
+ * skipped, and every non-static variable becomes a parameter; anything the
+ * parameter table cannot describe sends the effect to vkd3d instead.
+ */
+static BOOL effect_parse_declaration(Effect *effect, EffectLexer *lexer)
+{
+    EffectParameter type, *parameter;
+    BOOL is_static = FALSE, row_major = FALSE, known;
+    EffectLexer peek;
+    UINT flags = 0;
+
+    for (;;)
+    {
+        if (effect_token_is(lexer, "static"))
+            is_static = TRUE;
+        else if (effect_token_is(lexer, "shared"))
+            flags |= EFFECT_PARAMETER_SHARED;
+        else if (effect_token_is(lexer, "row_major"))
+            row_major = TRUE;
+        else if (effect_token_is(lexer, "column_major"))
+            row_major = FALSE;
+        else if (!effect_token_is(lexer, "uniform") && !effect_token_is(lexer, "extern")
+                && !effect_token_is(lexer, "const") && !effect_token_is(lexer, "volatile")
+                && !effect_token_is(lexer, "inline"))
+            break;
+        if (!effect_lex(lexer))
+            return FALSE;
+    }
+
+    /* Struct return types are fine, struct parameters are not */
+    memset(&type, 0, sizeof(type));
+    if (!effect_token_is_ident(lexer))
+        return FALSE;
+    known = effect_parse_type(lexer, &type);
+    if (!effect_lex(lexer) || !effect_token_is_ident(lexer))
+        return FALSE;
+    peek = *lexer;
+    if (effect_lex(&peek) && effect_token_is(&peek, "("))
+    {
+        *lexer = peek;
+        return effect_parse_function(lexer);
+    }
+
+    /* Static variables are only needed by the shaders */
+    if (is_static)
+    {
+        while (effect_lex(lexer) && !effect_token_is(lexer, ";"))
+        {
+            if ((effect_token_is(lexer, "(") && !effect_skip_block(lexer, "(", ")"))
+                    || (effect_token_is(lexer, "{") && !effect_skip_block(lexer, "{", "}")))
+                return FALSE;
+        }
+        return effect_token_is(lexer, ";");
+    }
+    if (!known)
+        return FALSE;
+    if (type.class == EFFECT_CLASS_MATRIX_COLUMNS && row_major)
+        type.class = EFFECT_CLASS_MATRIX_ROWS;
+    type.flags = flags;
+
+    for (;;)
+    {
+        if (!effect_array_reserve((void**) &effect->parameters, &effect->parameter_capacity,
+                effect->parameter_count + 1, sizeof(*effect->parameters)))
+            return FALSE;
+        parameter = &effect->parameters[effect->parameter_count++];
+        *parameter = type;
+        if ((parameter->name = effect_token_dup(lexer)) == NULL || !effect_lex(lexer))
+            return FALSE;
+
+        if (effect_token_is(lexer, "["))
+        {
+            if (!effect_lex(lexer) || !effect_token_count(lexer, 65535, &parameter->elements))
+                return FALSE;
+            if (!effect_lex(lexer) || !effect_token_is(lexer, "]") || !effect_lex(lexer))
+                return FALSE;
+        }
+
+        /* Register bindings only matter to the shaders */
+        while (effect_token_is(lexer, ":"))
+        {
+            if (!effect_lex(lexer) || !effect_token_is_ident(lexer))
+                return FALSE;
+            if (effect_token_is(lexer, "register") || effect_token_is(lexer, "packoffset"))
+            {
+                if (!effect_lex(lexer) || !effect_token_is(lexer, "(")
+                        || !effect_skip_block(lexer, "(", ")"))
+                    return FALSE;
+            }
+            else if (parameter->semantic != NULL
+                    || (parameter->semantic = effect_token_dup(lexer)) == NULL)
+                return FALSE;
+            if (!effect_lex(lexer))
+                return FALSE;
+        }
+
+        /* Annotations and texture initializers are not written */
+        if (effect_token_is(lexer, "="))
+        {
+            if (parameter->class == EFFECT_CLASS_OBJECT)
+            {
+                if (parameter->type < EFFECT_TYPE_SAMPLER || parameter->elements != 0
+                        || !effect_parse_sampler_state(effect, lexer, parameter))
+                    return FALSE;
+            }
+            else if (!effect_parse_initializer(lexer, parameter))
+                return FALSE;
+        }
+
+        if (effect_token_is(lexer, ";"))
+            return TRUE;
+        if (!effect_token_is(lexer, ",") || !effect_lex(lexer) || !effect_token_is_ident(lexer))
+            return FALSE;
+    }
+}
+
+static BOOL effect_parse(Effect *effect, const char *text, size_t size)
+{
+    EffectLexer lexer;
+    size_t start, i;
+
+    /* The parameter classes assume column_major matrices */
+    if (memmem(text, size, "pack_matrix", 11) != NULL)
+        return FALSE;
+
+    effect->source = (char*) malloc(size);
+    if (effect->source == NULL)
+        return FALSE;
+    memcpy(effect->source, text, size);
+    effect->source_size = size;
+
+    lexer.text = text;
+    lexer.size = size;
+    lexer.offset = 0;
+    while (effect_lex(&lexer))
+    {
+        if (effect_token_is(&lexer, ";"))
+            continue;
+        if (lexer.token_size >= 9 && !memcmp(lexer.token, "technique", 9))
+        {
+            /* technique10 and technique11 belong in fx_4_ and fx_5_ */
+            if (lexer.token_size != 9)
+                return FALSE;
+            start = lexer.token - text;
+            if (!effect_parse_technique(effect, &lexer))
+                return FALSE;
+
+            /* Keep the line numbers intact for the per-shader messages */
+            for (i = start; i < lexer.offset; ++i)
+            {
+                if (effect->source[i] != '\n')
+                    effect->source[i] = ' ';
+            }
+        }
+        else if (effect_token_is(&lexer, "struct"))
+        {
+            if (!effect_parse_struct(&lexer))
+                return FALSE;
+        }
+        else if (!effect_parse_declaration(effect, &lexer))
+            return FALSE;
+    }
+    return effect->technique_count > 0;
+}
+
+/* Shader Compilation */
+
+/* The pool is started by the first effect and stopped when the library is
+ * unloaded, so that no worker is left running code that is no longer mapped.
+ * Workers take shaders from the oldest queued effect, while each caller also
+ * compiles its own, so an effect finishes even when no worker could start.
+ */
+
+static Effect *effect_pool_head, *effect_pool_tail;
+static pthread_mutex_t effect_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t effect_pool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t effect_pool_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t effect_pool_once = PTHREAD_ONCE_INIT;
+static pthread_t effect_pool_threads[EFFECT_MAX_THREADS];
+static long effect_pool_thread_count;
+static BOOL effect_pool_shutdown; /* Protected by effect_pool_lock */
+
+/* Expects effect_pool_lock to be held, and drops it while compiling */
+static void effect_compile_next(Effect *effect)
+{
+    EffectShader *shader = &effect->shaders[effect->next_shader++];
+    Effect **link, *prev = NULL;
+
+    /* Nothing is left to hand out, so stop offering the effect */
+    if (effect->next_shader == effect->shader_count)
+    {
+        for (link = &effect_pool_head; *link != effect; link = &(*link)->next_queued)
+            prev = *link;
+        *link = effect->next_queued;
+        if (effect_pool_tail == effect)
+            effect_pool_tail = prev;
+    }
+    pthread_mutex_unlock(&effect_pool_lock);
+
+    shader->hr = D3DCompile2(effect->source, effect->source_size, effect->filename,
+            NULL, NULL, shader->entry_point, shader->profile, effect->flags, 0, 0,
+            NULL, 0, &shader->code, &shader->messages);
+
+    pthread_mutex_lock(&effect_pool_lock);
+    if (++effect->finished_shaders == effect->shader_count)
+        pthread_cond_broadcast(&effect_pool_done_cond);
+}
+
+static void* effect_pool_worker(void *arg)
+{
+    pthread_mutex_lock(&effect_pool_lock);
+    for (;;)
+    {
+        while (effect_pool_head == NULL && !effect_pool_shutdown)
+            pthread_cond_wait(&effect_pool_cond, &effect_pool_lock);
+        if (effect_pool_head == NULL)
+            break;
+        effect_compile_next(effect_pool_head);
+    }
+    pthread_mutex_unlock(&effect_pool_lock);
+    return NULL;
+}
+
+static void effect_pool_start(void)
+{
+    long cpus, i;
+
+    /* The threads that call D3DCompile make up the rest */
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > EFFECT_MAX_THREADS)
+        cpus = EFFECT_MAX_THREADS;
+    for (i = 1; i < cpus; ++i)
+    {
+        if (pthread_create(&effect_pool_threads[effect_pool_thread_count], NULL,
+                effect_pool_worker, NULL) != 0)
+            break;
+        effect_pool_thread_count += 1;
+    }
+}
+
+/* Runs on dlclose and at exit; workers finish any queued shaders first */
+static void __attribute__((destructor)) effect_pool_stop(void)
+{
+    long i;
+
+    pthread_mutex_lock(&effect_pool_lock);
+    effect_pool_shutdown = TRUE;
+    pthread_cond_broadcast(&effect_pool_cond);
+    pthread_mutex_unlock(&effect_pool_lock);
+
+    for (i = 0; i < effect_pool_thread_count; ++i)
+        pthread_join(effect_pool_threads[i], NULL);
+    effect_pool_thread_count = 0;
+}
+
+static void effect_compile_shaders(Effect *effect)
+{
+    if (effect->shader_count == 0)
+        return;
+    pthread_once(&effect_pool_once, effect_pool_start);
+
+    pthread_mutex_lock(&effect_pool_lock);
+    effect->next_queued = NULL;
+    if (effect_pool_tail != NULL)
+        effect_pool_tail->next_queued = effect;
+    else
+        effect_pool_head = effect;
+    effect_pool_tail = effect;
+    pthread_cond_broadcast(&effect_pool_cond);
+
+    while (effect->next_shader < effect->shader_count)
+        effect_compile_next(effect);
+    while (effect->finished_shaders < effect->shader_count)
+        pthread_cond_wait(&effect_pool_done_cond, &effect_pool_lock);
+    pthread_mutex_unlock(&effect_pool_lock);
+}
+/* fx_2_0 Assembly
+ *
+ * The binary is the tag, the size of an unstructured data block, the data
+ * block itself, and then the structure: parameters, techniques and objects.
+ * Names, types and values live in the data block and are referred to by
+ * their offset into it, where 0 means "none".
+ */
+
+static uint32_t effect_write_string(Buffer *data, const char *str)
+{
+    static const BYTE padding[4];
+    uint32_t offset = data->size;
+    size_t size;
+
+    if (str == NULL)
+        return 0;
+    size = strlen(str) + 1;
+    buffer_write_u32(data, size);
+    buffer_write(data, str, size);
+    buffer_write(data, padding, (4 - size % 4) % 4);
+    return offset;
+}
+
+static uint32_t effect_write_type(Buffer *data, UINT type, UINT class,
+        const char *name, const char *semantic, UINT elements, UINT columns, UINT rows)
+{
+    uint32_t name_offset = effect_write_string(data, name);
+    uint32_t semantic_offset = effect_write_string(data, semantic);
+    uint32_t offset = data->size;
+
+    buffer_write_u32(data, type);
+    buffer_write_u32(data, class);
+    buffer_write_u32(data, name_offset);
+    buffer_write_u32(data, semantic_offset);
+    buffer_write_u32(data, elements);
+    if (class != EFFECT_CLASS_OBJECT)
+    {
+        buffer_write_u32(data, columns);
+        buffer_write_u32(data, rows);
+    }
+    return offset;
+}
+
+/* A sampler's value is its state count and states, which are laid out like
+ * the states of a pass. Texture states take the next free object numbers,
+ * for the parameter names that are written as large objects.
+ */
+static uint32_t effect_write_sampler(Buffer *data, const EffectParameter *parameter,
+        uint32_t *next_object)
+{
+    const EffectSamplerState *state;
+    uint32_t *offsets, value_offset;
+    size_t i;
+
+    offsets = (uint32_t*) malloc(sizeof(*offsets) * 2 * parameter->state_count);
+    if (offsets == NULL)
+    {
+        data->failed = TRUE;
+        return 0;
+    }
+    for (i = 0; i < parameter->state_count; ++i)
+    {
+        state = &parameter->states[i];
+        if (state->texture != NULL)
+        {
+            offsets[i * 2] = effect_write_type(data, state->type, EFFECT_CLASS_OBJECT,
+                    NULL, NULL, 0, 0, 0);
+            offsets[i * 2 + 1] = data->size;
+            buffer_write_u32(data, (*next_object)++);
+        }
+        else
+        {
+            offsets[i * 2] = effect_write_type(data, state->type, EFFECT_CLASS_SCALAR,
+                    NULL, NULL, 0, 1, 1);
+            offsets[i * 2 + 1] = data->size;
+            buffer_write_u32(data, state->value);
+        }
+    }
+
+    value_offset = data->size;
+    buffer_write_u32(data, parameter->state_count);
+    for (i = 0; i < parameter->state_count; ++i)
+    {
+        buffer_write_u32(data, parameter->states[i].operation);
+        buffer_write_u32(data, 0);
+        buffer_write_u32(data, offsets[i * 2]);
+        buffer_write_u32(data, offsets[i * 2 + 1]);
+    }
+    free(offsets);
+    return value_offset;
+}
+
+/* Textures take the next free object numbers; they have no object data */
+static void effect_write_parameter(Buffer *data, Buffer *body, const EffectParameter *parameter,
+        uint32_t *next_object)
+{
+    size_t elements, components, e, i;
+    uint32_t type_offset, value_offset;
+
+    type_offset = effect_write_type(data, parameter->type, parameter->class, parameter->name,
+            parameter->semantic, parameter->elements, parameter->columns, parameter->rows);
+    value_offset = data->size;
+    elements = parameter->elements ? parameter->elements : 1;
+    components = parameter->rows * parameter->columns;
+    if (parameter->state_count > 0)
+        value_offset = effect_write_sampler(data, parameter, next_object);
+    for (e = 0; e < elements && parameter->state_count == 0; ++e)
+    {
+        if (parameter->class != EFFECT_CLASS_OBJECT)
+        {
+            for (i = 0; i < components; ++i)
+                buffer_write_u32(data, parameter->values ? parameter->values[e * components + i] : 0);
+        }
+        else if (parameter->type >= EFFECT_TYPE_SAMPLER)
+            buffer_write_u32(data, 0); /* Sampler state count */
+        else
+            buffer_write_u32(data, (*next_object)++);
+    }
+
+    buffer_write_u32(body, type_offset);
+    buffer_write_u32(body, value_offset);
+    buffer_write_u32(body, parameter->flags);
+    buffer_write_u32(body, 0); /* Annotation count */
+}
+
+static HRESULT effect_assemble(Effect *effect, ID3DBlob **effect_blob)
+{
+    static const BYTE padding[4];
+    const EffectTechnique *technique;
+    const EffectParameter *parameter;
+    const EffectShader *shader;
+    const EffectPass *pass;
+    Buffer data, body;
+    uint32_t type_offset, value_offset, object_count, next_object, reference_count;
+    size_t t, p, s, size;
+    BYTE *ptr;
+    HRESULT hr;
+
+    memset(&data, 0, sizeof(data));
+    memset(&body, 0, sizeof(body));
+
+    buffer_write_u32(&data, 0); /* Nothing may live at offset 0 */
+
+    /* The shaders come first, as object number shader index */
+    object_count = effect->shader_count;
+    reference_count = 0;
+    for (p = 0; p < effect->parameter_count; ++p)
+    {
+        parameter = &effect->parameters[p];
+        if (parameter->class == EFFECT_CLASS_OBJECT && parameter->type < EFFECT_TYPE_SAMPLER)
+            object_count += parameter->elements ? parameter->elements : 1;
+        for (s = 0; s < parameter->state_count; ++s)
+            reference_count += (parameter->states[s].texture != NULL);
+    }
+    object_count += reference_count;
+    next_object = effect->shader_count;
+
+    buffer_write_u32(&body, effect->parameter_count);
+    buffer_write_u32(&body, effect->technique_count);
+    buffer_write_u32(&body, 0);
+    buffer_write_u32(&body, object_count);
+    for (p = 0; p < effect->parameter_count; ++p)
+        effect_write_parameter(&data, &body, &effect->parameters[p], &next_object);
+
+    for (t = 0; t < effect->technique_count; ++t)
+    {
+        technique = &effect->techniques[t];
+        buffer_write_u32(&body, effect_write_string(&data, technique->name));
+        buffer_write_u32(&body, 0); /* Annotation count */
+        buffer_write_u32(&body, technique->pass_count);
+        for (p = 0; p < technique->pass_count; ++p)
+        {
+            pass = &effect->passes[technique->first_pass + p];
+            buffer_write_u32(&body, effect_write_string(&data, pass->name));
+            buffer_write_u32(&body, 0); /* Annotation count */
+            buffer_write_u32(&body, pass->state_count);
+            for (s = 0; s < pass->state_count; ++s)
+            {
+                shader = &effect->shaders[effect->states[pass->first_state + s]];
+                type_offset = effect_write_type(&data, shader->type, EFFECT_CLASS_OBJECT,
+                        NULL, NULL, 0, 0, 0);
+                value_offset = data.size;
+                buffer_write_u32(&data, effect->states[pass->first_state + s]);
+
+                buffer_write_u32(&body, (shader->type == EFFECT_TYPE_VERTEXSHADER)
+                        ? EFFECT_STATE_VERTEXSHADER : EFFECT_STATE_PIXELSHADER);
+                buffer_write_u32(&body, 0);
+                buffer_write_u32(&body, type_offset);
+                buffer_write_u32(&body, value_offset);
+            }
+        }
+    }
+
+    buffer_write_u32(&body, 0); /* Small objects */
+    buffer_write_u32(&body, effect->shader_count + reference_count); /* Large objects */
+    for (s = 0; s < effect->shader_count; ++s)
+    {
+        shader = &effect->shaders[s];
+        size = ID3D10Blob_GetBufferSize(shader->code);
+        buffer_write_u32(&body, shader->technique);
+        buffer_write_u32(&body, shader->pass);
+        buffer_write_u32(&body, 0);
+        buffer_write_u32(&body, shader->state);
+        buffer_write_u32(&body, 0); /* Type: shader bytecode */
+        buffer_write_u32(&body, size);
+        buffer_write(&body, ID3D10Blob_GetBufferPointer(shader->code), size);
+        buffer_write(&body, padding, (4 - size % 4) % 4);
+    }
+    for (p = 0; p < effect->parameter_count; ++p)
+    {
+        parameter = &effect->parameters[p];
+        for (s = 0; s < parameter->state_count; ++s)
+        {
+            if (parameter->states[s].texture == NULL)
+                continue;
+            size = strlen(parameter->states[s].texture) + 1;
+            buffer_write_u32(&body, 0xFFFFFFFF); /* Not in a technique */
+            buffer_write_u32(&body, p);
+            buffer_write_u32(&body, 0);
+            buffer_write_u32(&body, s);
+            buffer_write_u32(&body, 1); /* Type: parameter name */
+            buffer_write_u32(&body, size);
+            buffer_write(&body, parameter->states[s].texture, size);
+            buffer_write(&body, padding, (4 - size % 4) % 4);
+        }
+    }
+
+    hr = E_OUTOFMEMORY;
+    if (!data.failed && !body.failed)
+        hr = D3DCreateBlob(8 + data.size + body.size, effect_blob);
+    if (SUCCEEDED(hr))
+    {
+        ptr = (BYTE*) ID3D10Blob_GetBufferPointer(*effect_blob);
+        *(uint32_t*) ptr = EFFECT_FX_2_0_TAG;
+        *(uint32_t*) (ptr + 4) = data.size;
+        memcpy(ptr + 8, data.data, data.size);
+        memcpy(ptr + 8 + data.size, body.data, body.size);
+    }
+    free(data.data);
+    free(body.data);
+    return hr;
+}
+
+/* Effect Compiler */
+
+static BOOL effect_preprocess(const void *data, SIZE_T data_size, const char *filename,
+        const D3D_SHADER_MACRO *macros, struct vkd3d_shader_code *text)
+{
+    struct vkd3d_shader_preprocess_info preprocess_info;
+    struct vkd3d_shader_compile_info compile_info;
+    struct vkd3d_shader_compile_option option;
+    char *messages;
+    int ret;
+
+    compile_info_init(&compile_info, &preprocess_info, &option, data, data_size,
+            filename, macros);
+    compile_info.target_type = VKD3D_SHADER_TARGET_D3D_BYTECODE;
+
+    /* Preprocessor errors are left for vkd3d to report with the full effect */
+    ret = vkd3d_shader_preprocess(&compile_info, text, &messages);
+    if (messages)
+        vkd3d_shader_free_messages(messages);
+    return ret == VKD3D_OK;
+}
+
+static BOOL effect_messages_contain(const Buffer *messages, const char *line, size_t size)
+{
+    size_t start, end;
+
+    for (start = 0; start < messages->size; start = end + 1)
+    {
+        for (end = start; end < messages->size && messages->data[end] != '\n'; ++end);
+        if (end - start == size && !memcmp(messages->data + start, line, size))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Every shader is compiled from the whole source, so diagnostics outside of
+ * its own functions come once per shader; only the first copy is kept.
+ */
+static HRESULT effect_create_messages(Effect *effect, ID3DBlob **messages_blob)
+{
+    const char *text, *line;
+    size_t size, length, i;
+    Buffer messages;
+    HRESULT hr;
+
+    memset(&messages, 0, sizeof(messages));
+    for (i = 0; i < effect->shader_count; ++i)
+    {
+        if (effect->shaders[i].messages == NULL)
+            continue;
+        text = (const char*) ID3D10Blob_GetBufferPointer(effect->shaders[i].messages);
+        size = ID3D10Blob_GetBufferSize(effect->shaders[i].messages);
+        for (line = text; line < text + size; line += length + 1)
+        {
+            for (length = 0; line + length < text + size && line[length] != '\n'; ++length);
+            if (effect_messages_contain(&messages, line, length))
+                continue;
+            buffer_write(&messages, line, length);
+            buffer_write(&messages, "\n", 1);
+        }
+    }
+    if (messages.failed)
+    {
+        free(messages.data);
+        return E_OUTOFMEMORY;
+    }
+    if (messages.size == 0)
+        return S_OK;
+
+    hr = CompilerBlob_Create(messages.size, D3DCOMPILER_BLOB_MESSAGES, messages_blob);
+    if (SUCCEEDED(hr))
+        memcpy(ID3D10Blob_GetBufferPointer(*messages_blob), messages.data, messages.size);
+    free(messages.data);
+    return hr;
+}
+
+static void effect_free(Effect *effect)
+{
+    size_t i, j;
+
+    for (i = 0; i < effect->shader_count; ++i)
+    {
+        free(effect->shaders[i].profile);
+        free(effect->shaders[i].entry_point);
+        if (effect->shaders[i].code != NULL)
+            ID3D10Blob_Release(effect->shaders[i].code);
+        if (effect->shaders[i].messages != NULL)
+            ID3D10Blob_Release(effect->shaders[i].messages);
+    }
+    for (i = 0; i < effect->pass_count; ++i)
+        free(effect->passes[i].name);
+    for (i = 0; i < effect->technique_count; ++i)
+        free(effect->techniques[i].name);
+    for (i = 0; i < effect->parameter_count; ++i)
+    {
+        free(effect->parameters[i].name);
+        free(effect->parameters[i].semantic);
+        free(effect->parameters[i].values);
+        for (j = 0; j < effect->parameters[i].state_count; ++j)
+            free(effect->parameters[i].states[j].texture);
+        free(effect->parameters[i].states);
+    }
+    free(effect->shaders);
+    free(effect->passes);
+    free(effect->techniques);
+    free(effect->states);
+    free(effect->parameters);
+    free(effect->source);
+}
+
+/* Returns FALSE if the effect should be compiled by vkd3d as a whole */
+static BOOL effect_compile(const void *data, SIZE_T data_size, const char *filename,
+        const D3D_SHADER_MACRO *macros, UINT flags, ID3DBlob **effect_blob,
+        ID3DBlob **messages_blob, HRESULT *hr)
+{
+    struct vkd3d_shader_code text;
+    Effect effect;
+    BOOL handled;
+    size_t i;
+
+    if (!effect_preprocess(data, data_size, filename, macros, &text))
+        return FALSE;
+
+    memset(&effect, 0, sizeof(effect));
+    effect.filename = filename;
+    effect.flags = flags;
+    handled = effect_parse(&effect, (const char*) text.code, text.size);
+    vkd3d_shader_free_shader_code(&text);
+    if (!handled)
+    {
+        effect_free(&effect);
+        return FALSE;
+    }
+
+    effect_compile_shaders(&effect);
+
+    *hr = S_OK;
+    for (i = 0; i < effect.shader_count && SUCCEEDED(*hr); ++i)
+        *hr = effect.shaders[i].hr;
+
+    if (messages_blob)
+    {
+        HRESULT messages_hr = effect_create_messages(&effect, messages_blob);
+        if (FAILED(messages_hr))
+            *hr = messages_hr;
+    }
+    if (SUCCEEDED(*hr))
+        *hr = effect_assemble(&effect, effect_blob);
+
+    effect_free(&effect);
+    return TRUE;
+}
+
+/* Wine's D3DCompile implementation */
+
+static HRESULT hresult_from_vkd3d_result(int vkd3d_result)
+{
+    switch (vkd3d_result)
+    {
+        case VKD3D_OK:
+            return S_OK;
+        case VKD3D_ERROR_INVALID_SHADER:
+            WARN("Invalid shader bytecode.\n");
+            /* fall-through */
+        case VKD3D_ERROR:
+            return E_FAIL;
+        case VKD3D_ERROR_OUT_OF_MEMORY:
+            return E_OUTOFMEMORY;
+        case VKD3D_ERROR_INVALID_ARGUMENT:
+            return E_INVALIDARG;
+        case VKD3D_ERROR_NOT_IMPLEMENTED:
+            return E_NOTIMPL;
+        default:
+            FIXME("Unhandled vkd3d result %d.\n", vkd3d_result);
+            return E_FAIL;
+    }
+}
+
+HRESULT WINAPI D3DCompile2(const void *data, SIZE_T data_size, const char *filename,
+        const D3D_SHADER_MACRO *macros, ID3DInclude *include, const char *entry_point,
+        const char *profile, UINT flags, UINT effect_flags, UINT secondary_flags,
+        const void *secondary_data, SIZE_T secondary_data_size, ID3DBlob **shader_blob,
+        ID3DBlob **messages_blob)
+{
+#if 0 /* FIXME: Include support */
+    struct d3dcompiler_include_from_file include_from_file;
+#endif
+    struct vkd3d_shader_preprocess_info preprocess_info;
+    struct vkd3d_shader_hlsl_source_info hlsl_info;
+    struct vkd3d_shader_compile_option options[2];
+    struct vkd3d_shader_compile_info compile_info;
+    struct vkd3d_shader_compile_option *option;
+    struct vkd3d_shader_code byte_code;
+    size_t profile_len, i;
+    char *messages;
+    HRESULT hr;
+    int ret;
+
+    static const char * const d3dbc_profiles[] =
+    {
+        "fx_2_",
+
+        "ps.1.",
+        "ps.2.",
+        "ps.3.",
+
+        "ps_1_",
+        "ps_2_",
+        "ps_3_",
+
+        "vs.1.",
+        "vs.2.",
+        "vs.3.",
+
+        "vs_1_",
+        "vs_2_",
+        "vs_3_",
+
+        "tx_1_",
+    };
+
+    TRACE("data %p, data_size %Iu, filename %s, macros %p, include %p, entry_point %s, "
+            "profile %s, flags %#x, effect_flags %#x, secondary_flags %#x, secondary_data %p, "
+            "secondary_data_size %Iu, shader_blob %p, messages_blob %p.\n",
+            data, data_size, debugstr_a(filename), macros, include, debugstr_a(entry_point),
+            debugstr_a(profile), flags, effect_flags, secondary_flags, secondary_data,
+            secondary_data_size, shader_blob, messages_blob);
+
+#if 0 /* FIXME: Include support */
+    if (include == D3D_COMPILE_STANDARD_FILE_INCLUDE)
+    {
+        include_from_file.ID3DInclude_iface.lpVtbl = &d3dcompiler_include_from_file_vtbl;
+        include = &include_from_file.ID3DInclude_iface;
+    }
+#endif
+
+#ifndef D3DCOMPILER_SERVER
+    if (server_compile(data, data_size, filename, macros, entry_point, profile, flags,
+            effect_flags, secondary_flags, secondary_data, secondary_data_size,
+            shader_blob, messages_blob, &hr))
+        return hr;
+#endif
+
+    if (flags & ~D3DCOMPILE_DEBUG)
+        FIXME("Ignoring flags %#x.\n", flags);
+    if (effect_flags)
+        FIXME("Ignoring effect flags %#x.\n", effect_flags);
+    if (secondary_flags)
+        FIXME("Ignoring secondary flags %#x.\n", secondary_flags);
+
+    if (messages_blob)
+        *messages_blob = NULL;
+
+    if (!strncmp(profile, "fx_2_", 5) && effect_compile(data, data_size, filename, macros,
+            flags, shader_blob, messages_blob, &hr))
+        return hr;
+
+    compile_info_init(&compile_info, &preprocess_info, options, data, data_size,
+            filename, macros);
+
+    profile_len = strlen(profile);
+    for (i = 0; i < ARRAY_SIZE(d3dbc_profiles); ++i)
+    {
+        size_t len = strlen(d3dbc_profiles[i]);
+
+        if (len <= profile_len && !memcmp(profile, d3dbc_profiles[i], len))
+        {
+            compile_info.target_type = VKD3D_SHADER_TARGET_D3D_BYTECODE;
+            break;
+        }
+    }
+
+    preprocess_info.next = &hlsl_info;
+#if 0 /* FIXME: Include support */
+    preprocess_info.pfn_open_include = open_include;
+    preprocess_info.pfn_close_include = close_include;
+    preprocess_info.include_context = include;
+#endif
+
+    hlsl_info.type = VKD3D_SHADER_STRUCTURE_TYPE_HLSL_SOURCE_INFO;
+    hlsl_info.next = NULL;
+    hlsl_info.profile = profile;
+    hlsl_info.entry_point = entry_point;
+    hlsl_info.secondary_code.code = secondary_data;
+    hlsl_info.secondary_code.size = secondary_data_size;
+
+    if (!(flags & D3DCOMPILE_DEBUG))
+    {
+        option = &options[compile_info.option_count++];
+        option->name = VKD3D_SHADER_COMPILE_OPTION_STRIP_DEBUG;
+        option->value = true;
+    }
+
+    ret = vkd3d_shader_compile(&compile_info, &byte_code, &messages);
+    if (messages)
+    {
+        if (messages_blob)
+        {
+            size_t size = strlen(messages);
+            if (FAILED(hr = CompilerBlob_Create(size, D3DCOMPILER_BLOB_MESSAGES, messages_blob)))
+            {
+                vkd3d_shader_free_messages(messages);
+                vkd3d_shader_free_shader_code(&byte_code);
+                return hr;
+            }
+            memcpy(ID3D10Blob_GetBufferPointer(*messages_blob), messages, size);
+        }
+        vkd3d_shader_free_messages(messages);
+    }
+
+    if (!ret)
+    {
+        if (FAILED(hr = D3DCreateBlob(byte_code.size, shader_blob)))
+        {
+            vkd3d_shader_free_shader_code(&byte_code);
+            return hr;
+        }
+        memcpy(ID3D10Blob_GetBufferPointer(*shader_blob), byte_code.code, byte_code.size);
+        vkd3d_shader_free_shader_code(&byte_code);
+    }
+
+    return hresult_from_vkd3d_result(ret);
+}
+
+HRESULT WINAPI D3DCompile(const void *data, SIZE_T data_size, const char *filename,
+        const D3D_SHADER_MACRO *defines, ID3DInclude *include, const char *entrypoint,
+        const char *target, UINT sflags, UINT eflags, ID3DBlob **shader, ID3DBlob **error_messages)
+{
     TRACE("data %p, data_size %Iu, filename %s, defines %p, include %p, entrypoint %s, "
             "target %s, sflags %#x, eflags %#x, shader %p, error_messages %p.\n",
             data, data_size, debugstr_a(filename), defines, include, debugstr_a(entrypoint),
@@ -700,4 +2854,734 @@ HRESULT WINAPI D3DCompile(const void *data, SIZE_T data_size, const char *filena
             eflags, 0, NULL, 0, shader, error_messages);
 }
 
+#ifdef D3DCOMPILER_SERVER
+
+/* Compile Server
+ *
+ * Usage: d3dcompiler-server <socket path> [worker count] [cache budget in MiB]
+ *
+ * Connections are accepted on the main thread and queued for a pool of
+ * workers, each of which serves one request per connection. Results are
+ * cached by the full request payload, and a request that is already being
+ * compiled by another worker waits for that result instead of compiling it
+ * again. Failed compiles are not cached. Each cached result holds up to two
+ * shared memory descriptors, so the number of cached results is limited by
+ * RLIMIT_NOFILE, and with a budget by the size of the cached blobs as well;
+ * least recently used results are evicted first. Results that are still being
+ * sent are pinned and only freed once their last reply is done, so the cache
+ * may stay over its budget while they are in use.
+ *
+ * Each cache miss is compiled by a child process, which the server starts by
+ * running itself with SERVER_CHILD_ARGUMENT. The child reads the request from
+ * its standard input, a socket, and replies on it like the server would. If
+ * it crashes or runs past SERVER_COMPILE_TIMEOUT, only the requests for that
+ * shader fail and the server keeps serving everyone else.
+ */
+
+#define SERVER_QUEUE_SIZE 256
+#define SERVER_CACHE_BUCKETS 1024
+#define SERVER_CHILD_ARGUMENT "--compile-child"
+#define SERVER_COMPILE_TIMEOUT 60 /* Seconds, less than SERVER_REPLY_TIMEOUT */
+
+typedef struct ServerCacheEntry
+{
+    struct ServerCacheEntry *next;
+    struct ServerCacheEntry *lru_prev;
+    struct ServerCacheEntry *lru_next;
+    uint64_t hash;
+    char *key;
+    size_t key_size;
+    ULONG users; /* Workers still replying with this entry */
+    BOOL done;
+    BOOL evicted;
+    HRESULT hr;
+    ID3DBlob *code;
+    ID3DBlob *messages;
+} ServerCacheEntry;
+
+static ServerCacheEntry *server_cache[SERVER_CACHE_BUCKETS];
+static ServerCacheEntry *server_lru_head, *server_lru_tail;
+static size_t server_cache_count, server_cache_limit;
+static size_t server_cache_pinned_bytes; /* Cached bytes of finished entries with users */
+static pthread_mutex_t server_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t server_cache_cond = PTHREAD_COND_INITIALIZER;
+
+static int server_queue[SERVER_QUEUE_SIZE];
+static size_t server_queue_head, server_queue_count;
+static pthread_mutex_t server_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t server_queue_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t server_hash(const char *data, size_t size)
+{
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for (i = 0; i < size; ++i)
+    {
+        hash ^= (unsigned char) data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* These expect server_cache_lock to be held, except for server_cache_trim */
+
+static size_t server_cache_entry_size(ServerCacheEntry *entry)
+{
+    size_t size = 0;
+
+    /* Failed results are never converted to cached blobs */
+    if (FAILED(entry->hr))
+        return 0;
+    if (entry->code != NULL)
+        size += ID3D10Blob_GetBufferSize(entry->code);
+    if (entry->messages != NULL)
+        size += ID3D10Blob_GetBufferSize(entry->messages);
+    return size;
+}
+
+static void server_cache_free(ServerCacheEntry *entry)
+{
+    if (entry->code != NULL)
+        ID3D10Blob_Release(entry->code);
+    if (entry->messages != NULL)
+        ID3D10Blob_Release(entry->messages);
+    free(entry->key);
+    free(entry);
+}
+
+static void server_cache_lru_unlink(ServerCacheEntry *entry)
+{
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        server_lru_head = entry->lru_next;
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        server_lru_tail = entry->lru_prev;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void server_cache_lru_push(ServerCacheEntry *entry)
+{
+    entry->lru_next = server_lru_head;
+    if (server_lru_head != NULL)
+        server_lru_head->lru_prev = entry;
+    else
+        server_lru_tail = entry;
+    server_lru_head = entry;
+}
+
+static void server_cache_evict(ServerCacheEntry *entry)
+{
+    ServerCacheEntry **link = &server_cache[entry->hash % SERVER_CACHE_BUCKETS];
+
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    server_cache_lru_unlink(entry);
+    server_cache_count -= 1;
+
+    entry->evicted = TRUE;
+    if (entry->users == 0)
+        server_cache_free(entry);
+}
+
+static void server_cache_trim(void)
+{
+    D3DCOMPILER_MEMORY_STATS stats;
+    ServerCacheEntry *entry;
+    size_t cached;
+
+    pthread_mutex_lock(&server_cache_lock);
+    for (;;)
+    {
+        /* Only cached blobs count against the budget; compiles in flight
+         * and replies being sent are not something eviction can give back
+         */
+        D3DCompilerGetMemoryStats(&stats);
+        cached = stats.Bytes[D3DCOMPILER_BLOB_CACHED];
+        if (server_cache_count <= server_cache_limit
+                && (stats.Budget == 0 || cached <= stats.Budget
+                        || cached <= server_cache_pinned_bytes))
+            break;
+
+        /* Entries that are still compiling or replying are pinned */
+        entry = server_lru_tail;
+        while (entry != NULL && (!entry->done || entry->users > 0))
+            entry = entry->lru_prev;
+        if (entry == NULL)
+            break;
+        server_cache_evict(entry);
+    }
+    pthread_mutex_unlock(&server_cache_lock);
+}
+
+static void server_budget_callback(const D3DCOMPILER_MEMORY_STATS *stats, void *userdata)
+{
+    server_cache_trim();
+}
+
+typedef struct ServerReader
+{
+    const char *data;
+    size_t size;
+    size_t offset;
+    BOOL failed;
+} ServerReader;
+
+static uint32_t server_read_u32(ServerReader *reader)
+{
+    uint32_t value;
+
+    if (reader->failed || reader->size - reader->offset < sizeof(value))
+    {
+        reader->failed = TRUE;
+        return 0;
+    }
+    memcpy(&value, reader->data + reader->offset, sizeof(value));
+    reader->offset += sizeof(value);
+    return value;
+}
+
+static const void* server_read_data(ServerReader *reader, size_t *size)
+{
+    const void *data;
+    uint32_t len = server_read_u32(reader);
+
+    *size = 0;
+    if (reader->failed || len == SERVER_NULL_STRING)
+        return NULL;
+    if (reader->size - reader->offset < len)
+    {
+        reader->failed = TRUE;
+        return NULL;
+    }
+    data = reader->data + reader->offset;
+    reader->offset += len;
+    *size = len;
+    return data;
+}
+
+static const char* server_read_string(ServerReader *reader)
+{
+    size_t size;
+    const char *str = (const char*) server_read_data(reader, &size);
+
+    if (str != NULL && (size == 0 || str[size - 1] != '\0'))
+    {
+        reader->failed = TRUE;
+        return NULL;
+    }
+    return str;
+}
+
+static HRESULT server_compile_request(ServerReader *reader, ID3DBlob **code, ID3DBlob **messages)
+{
+    D3D_SHADER_MACRO *macros;
+    const void *data, *secondary_data;
+    const char *filename, *entry_point, *profile;
+    size_t data_size, secondary_data_size;
+    UINT flags, effect_flags, secondary_flags;
+    uint32_t macro_count, i;
+    HRESULT hr;
+
+    flags = server_read_u32(reader);
+    effect_flags = server_read_u32(reader);
+    secondary_flags = server_read_u32(reader);
+    data = server_read_data(reader, &data_size);
+    filename = server_read_string(reader);
+    entry_point = server_read_string(reader);
+    profile = server_read_string(reader);
+    secondary_data = server_read_data(reader, &secondary_data_size);
+    macro_count = server_read_u32(reader);
+    if (reader->failed || profile == NULL || macro_count > reader->size / 8)
+        return E_INVALIDARG;
+
+    macros = (D3D_SHADER_MACRO*) malloc(sizeof(D3D_SHADER_MACRO) * (macro_count + 1));
+    if (macros == NULL)
+        return E_OUTOFMEMORY;
+    for (i = 0; i < macro_count; ++i)
+    {
+        macros[i].Name = server_read_string(reader);
+        macros[i].Definition = server_read_string(reader);
+        if (macros[i].Name == NULL)
+            reader->failed = TRUE;
+    }
+    macros[macro_count].Name = NULL;
+    macros[macro_count].Definition = NULL;
+    if (reader->failed || reader->offset != reader->size)
+    {
+        free(macros);
+        return E_INVALIDARG;
+    }
+
+    hr = D3DCompile2(data, data_size, filename, macros, NULL, entry_point, profile,
+            flags, effect_flags, secondary_flags, secondary_data, secondary_data_size,
+            code, messages);
+    free(macros);
+    return hr;
+}
+
+/* Replaces the blobs of a compile with shared memory copies for the clients.
+ * If they cannot be made, the clients are told to compile in-process.
+ */
+static HRESULT server_share_result(HRESULT hr, ID3DBlob **code, ID3DBlob **messages)
+{
+    D3DCOMPILER_BLOB_KIND kind;
+    ID3DBlob **blobs[2], *shared;
+    int i;
+
+    if (FAILED(hr) && *code != NULL)
+    {
+        ID3D10Blob_Release(*code);
+        *code = NULL;
+    }
+
+    /* Failures are not cached, so their messages are ordinary messages */
+    blobs[0] = code;
+    blobs[1] = messages;
+    for (i = 0; i < 2; ++i)
+    {
+        if (*blobs[i] == NULL)
+            continue;
+        kind = SUCCEEDED(hr) ? D3DCOMPILER_BLOB_CACHED : D3DCOMPILER_BLOB_MESSAGES;
+        if (FAILED(CompilerBlob_CreateShared(*blobs[i], kind, &shared)))
+            shared = NULL;
+        ID3D10Blob_Release(*blobs[i]);
+        *blobs[i] = shared;
+        if (shared == NULL)
+            hr = SERVER_E_UNSUPPORTED;
+    }
+
+    if (hr == SERVER_E_UNSUPPORTED)
+    {
+        for (i = 0; i < 2; ++i)
+        {
+            if (*blobs[i] != NULL)
+                ID3D10Blob_Release(*blobs[i]);
+            *blobs[i] = NULL;
+        }
+    }
+    return hr;
+}
+
+static BOOL server_send_reply(int fd, HRESULT hr, ID3DBlob *code, ID3DBlob *messages)
+{
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    ServerReply reply;
+    int fds[2], fd_count = 0;
+    ssize_t ret;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = SERVER_MAGIC;
+    reply.hr = hr;
+    if (code)
+    {
+        reply.has_code = 1;
+        reply.code_size = ((CompilerBlob*) code)->size;
+        fds[fd_count++] = ((CompilerBlob*) code)->fd;
+    }
+    if (messages)
+    {
+        reply.has_messages = 1;
+        reply.messages_size = ((CompilerBlob*) messages)->size;
+        fds[fd_count++] = ((CompilerBlob*) messages)->fd;
+    }
+
+    iov.iov_base = &reply;
+    iov.iov_len = sizeof(reply);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd_count > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    do
+    {
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0)
+        return FALSE;
+    return server_send(fd, (char*) &reply + ret, sizeof(reply) - ret);
+}
+
+/* Compiles a request payload in a child process; see server_child_main */
+static HRESULT server_compile_child(const char *payload, size_t size, ID3DBlob **code, ID3DBlob **messages)
+{
+    extern char **environ;
+    posix_spawn_file_actions_t actions;
+    ServerRequestHeader header;
+    ServerReply reply;
+    char *argv[3];
+    int sv[2], fds[2], fd_count, status, i;
+    pid_t pid;
+    HRESULT hr;
+    BOOL valid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+        return SERVER_E_UNSUPPORTED;
+
+    argv[0] = (char*) "d3dcompiler-server";
+    argv[1] = (char*) SERVER_CHILD_ARGUMENT;
+    argv[2] = NULL;
+    if (posix_spawn_file_actions_init(&actions) != 0)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        return SERVER_E_UNSUPPORTED;
+    }
+    /* dup2 onto itself clears close-on-exec as well */
+    if (posix_spawn_file_actions_adddup2(&actions, sv[1], 0) != 0
+            || posix_spawn(&pid, "/proc/self/exe", &actions, NULL, argv, environ) != 0)
+        pid = -1;
+    posix_spawn_file_actions_destroy(&actions);
+    close(sv[1]);
+    if (pid < 0)
+    {
+        close(sv[0]);
+        return SERVER_E_UNSUPPORTED;
+    }
+
+    header.magic = SERVER_MAGIC;
+    header.version = SERVER_VERSION;
+    header.size = size;
+    fd_count = 0;
+    valid = server_set_timeout(sv[0], SERVER_COMPILE_TIMEOUT)
+            && server_send(sv[0], &header, sizeof(header))
+            && server_send(sv[0], payload, size)
+            && server_recv_reply(sv[0], &reply, fds, &fd_count);
+    close(sv[0]);
+
+    /* A child that is stuck, or that sent garbage, is not waited for */
+    if (!valid)
+        kill(pid, SIGKILL);
+    status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+    if (!valid)
+    {
+        for (i = 0; i < fd_count; ++i)
+            close(fds[i]);
+
+        /* Killed: the shader crashed or hung the compiler. Otherwise the
+         * child could not run at all, so let the client compile it.
+         */
+        return WIFSIGNALED(status) ? E_FAIL : SERVER_E_UNSUPPORTED;
+    }
+
+    /* The blobs take over the descriptors, which are sent on to clients */
+    hr = S_OK;
+    if (reply.has_code)
+    {
+        hr = D3DCreateBlobFromSharedMemory(fds[0], reply.code_size,
+                SUCCEEDED(reply.hr) ? D3DCOMPILER_BLOB_CACHED : D3DCOMPILER_BLOB_MESSAGES,
+                code);
+        if (SUCCEEDED(hr))
+            ((CompilerBlob*) *code)->fd = fds[0];
+        else
+            close(fds[0]);
+    }
+    if (reply.has_messages)
+    {
+        if (SUCCEEDED(hr))
+            hr = D3DCreateBlobFromSharedMemory(fds[fd_count - 1], reply.messages_size,
+                    SUCCEEDED(reply.hr) ? D3DCOMPILER_BLOB_CACHED : D3DCOMPILER_BLOB_MESSAGES,
+                    messages);
+        if (SUCCEEDED(hr))
+            ((CompilerBlob*) *messages)->fd = fds[fd_count - 1];
+        else
+            close(fds[fd_count - 1]);
+    }
+    if (FAILED(hr))
+    {
+        if (*code != NULL)
+            ID3D10Blob_Release(*code);
+        *code = NULL;
+        return SERVER_E_UNSUPPORTED;
+    }
+    return reply.hr;
+}
+
+static void server_handle(int fd)
+{
+    ServerRequestHeader header;
+    ServerCacheEntry *entry, **bucket;
+    char *payload;
+    uint64_t hash;
+
+    if (!server_peer_is_trusted(fd) || !server_set_timeout(fd, SERVER_CLIENT_TIMEOUT))
+        return;
+    if (!server_recv(fd, &header, sizeof(header)))
+        return;
+    if (header.magic != SERVER_MAGIC || header.version != SERVER_VERSION
+            || header.size > SERVER_MAX_REQUEST)
+    {
+        server_send_reply(fd, SERVER_E_UNSUPPORTED, NULL, NULL);
+        return;
+    }
+    payload = (char*) malloc(header.size);
+    if (payload == NULL)
+    {
+        server_send_reply(fd, SERVER_E_UNSUPPORTED, NULL, NULL);
+        return;
+    }
+    if (!server_recv(fd, payload, header.size))
+    {
+        free(payload);
+        return;
+    }
+
+    hash = server_hash(payload, header.size);
+    bucket = &server_cache[hash % SERVER_CACHE_BUCKETS];
+
+    pthread_mutex_lock(&server_cache_lock);
+    for (entry = *bucket; entry != NULL; entry = entry->next)
+    {
+        if (entry->hash == hash && entry->key_size == header.size
+                && !memcmp(entry->key, payload, header.size))
+            break;
+    }
+    if (entry != NULL)
+    {
+        free(payload);
+        if (entry->done && entry->users == 0)
+            server_cache_pinned_bytes += server_cache_entry_size(entry);
+        entry->users += 1;
+        server_cache_lru_unlink(entry);
+        server_cache_lru_push(entry);
+        while (!entry->done)
+            pthread_cond_wait(&server_cache_cond, &server_cache_lock);
+        pthread_mutex_unlock(&server_cache_lock);
+    }
+    else
+    {
+        entry = (ServerCacheEntry*) calloc(1, sizeof(ServerCacheEntry));
+        if (entry == NULL)
+        {
+            pthread_mutex_unlock(&server_cache_lock);
+            free(payload);
+            server_send_reply(fd, SERVER_E_UNSUPPORTED, NULL, NULL);
+            return;
+        }
+        entry->hash = hash;
+        entry->key = payload;
+        entry->key_size = header.size;
+        entry->users = 1;
+        entry->next = *bucket;
+        *bucket = entry;
+        server_cache_lru_push(entry);
+        server_cache_count += 1;
+        pthread_mutex_unlock(&server_cache_lock);
+
+        entry->hr = server_compile_child(payload, header.size, &entry->code, &entry->messages);
+
+        pthread_mutex_lock(&server_cache_lock);
+        entry->done = TRUE;
+        server_cache_pinned_bytes += server_cache_entry_size(entry);
+        pthread_cond_broadcast(&server_cache_cond);
+
+        /* Failures may be transient (out of memory, out of descriptors), so
+         * they only go to the requests that were already waiting for them
+         */
+        if (FAILED(entry->hr))
+            server_cache_evict(entry);
+        pthread_mutex_unlock(&server_cache_lock);
+    }
+
+    /* Finished entries are never modified, and are freed by the last user */
+    server_send_reply(fd, entry->hr, entry->code, entry->messages);
+
+    pthread_mutex_lock(&server_cache_lock);
+    entry->users -= 1;
+    if (entry->users == 0)
+    {
+        server_cache_pinned_bytes -= server_cache_entry_size(entry);
+        if (entry->evicted)
+            server_cache_free(entry);
+    }
+    pthread_mutex_unlock(&server_cache_lock);
+
+    /* Replies that were pinning the cache over its budget may now be evicted */
+    server_cache_trim();
+}
+
+static void* server_worker(void *arg)
+{
+    int fd;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&server_queue_lock);
+        while (server_queue_count == 0)
+            pthread_cond_wait(&server_queue_cond, &server_queue_lock);
+        fd = server_queue[server_queue_head];
+        server_queue_head = (server_queue_head + 1) % SERVER_QUEUE_SIZE;
+        server_queue_count -= 1;
+        pthread_cond_broadcast(&server_queue_cond);
+        pthread_mutex_unlock(&server_queue_lock);
+
+        server_handle(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Raises the descriptor limit as far as allowed, and sizes the cache so that
+ * its descriptors leave room for queued connections and in-flight compiles.
+ */
+static void server_cache_init_limit(long workers)
+{
+    struct rlimit limit;
+    size_t reserve;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+        limit.rlim_cur = 1024;
+    else if (limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+            getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > 1024 * 1024)
+        limit.rlim_cur = 1024 * 1024;
+
+    reserve = SERVER_QUEUE_SIZE + workers * 4 + 32;
+    if (reserve > limit.rlim_cur / 2)
+        reserve = limit.rlim_cur / 2;
+    server_cache_limit = (limit.rlim_cur - reserve) / 2;
+    if (server_cache_limit < 1)
+        server_cache_limit = 1;
+}
+
+/* Serves a single compile for server_compile_child on standard input */
+static int server_child_main(void)
+{
+    ServerRequestHeader header;
+    ServerReader reader;
+    ID3DBlob *code = NULL, *messages = NULL;
+    char *payload;
+    HRESULT hr;
+
+    if (!server_recv(0, &header, sizeof(header)) || header.magic != SERVER_MAGIC
+            || header.version != SERVER_VERSION || header.size > SERVER_MAX_REQUEST)
+        return 1;
+    payload = (char*) malloc(header.size);
+    if (payload == NULL)
+    {
+        server_send_reply(0, SERVER_E_UNSUPPORTED, NULL, NULL);
+        return 1;
+    }
+    if (!server_recv(0, payload, header.size))
+        return 1;
+
+    reader.data = payload;
+    reader.size = header.size;
+    reader.offset = 0;
+    reader.failed = FALSE;
+    hr = server_compile_request(&reader, &code, &messages);
+    hr = server_share_result(hr, &code, &messages);
+    return server_send_reply(0, hr, code, messages) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    const char *path;
+    pthread_t thread;
+    long workers, i;
+    int listener, fd;
+
+    if (argc == 2 && !strcmp(argv[1], SERVER_CHILD_ARGUMENT))
+        return server_child_main();
+
+    path = (argc > 1) ? argv[1] : getenv("D3DCOMPILER_SERVER");
+    if (path == NULL || *path == '\0' || strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Usage: %s <socket path> [worker count] [cache budget in MiB]\n", argv[0]);
+        return 1;
+    }
+    workers = (argc > 2) ? strtol(argv[2], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+        workers = 1;
+    if (argc > 3)
+    {
+        D3DCompilerSetMemoryBudget(
+            (SIZE_T) strtoul(argv[3], NULL, 10) * 1024 * 1024,
+            server_budget_callback,
+            NULL
+        );
+    }
+
+    server_cache_init_limit(workers);
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) < 0
+            || listen(listener, SOMAXCONN) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    for (i = 0; i < workers; ++i)
+    {
+        if (pthread_create(&thread, NULL, server_worker, NULL) != 0)
+        {
+            perror("pthread_create");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+
+    for (;;)
+    {
+        fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            /* Wait for workers to close connections, then try again */
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                usleep(10000);
+                continue;
+            }
+            perror("accept");
+            return 1;
+        }
+
+        pthread_mutex_lock(&server_queue_lock);
+        while (server_queue_count == SERVER_QUEUE_SIZE)
+            pthread_cond_wait(&server_queue_cond, &server_queue_lock);
+        server_queue[(server_queue_head + server_queue_count) % SERVER_QUEUE_SIZE] = fd;
+        server_queue_count += 1;
+        pthread_cond_broadcast(&server_queue_cond);
+        pthread_mutex_unlock(&server_queue_lock);
+    }
+}
+
+#endif /* D3DCOMPILER_SERVER */
+
 #endif
@@ -0,0 +1,83 @@
+/* d3dcompiler-native - Wine d3dcompiler Repurposed for Native Applications
+ * Copyright (c) 2022 Ethan "flibitijibibo" Lee
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Extensions to the d3dcompiler API that are specific to d3dcompiler-native */
+
+#ifndef D3DCOMPILER_NATIVE_H
+#define D3DCOMPILER_NATIVE_H
+
+#include <d3dcommon.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Blob Memory Accounting
+ *
+ * Every live ID3DBlob created by this library is counted, by kind, until its
+ * last Release. The counters cover the whole process.
+ */
+
+typedef enum D3DCOMPILER_BLOB_KIND
+{
+    D3DCOMPILER_BLOB_BYTECODE, /* Compiled shaders and effects */
+    D3DCOMPILER_BLOB_MESSAGES, /* Compiler errors and warnings */
+    D3DCOMPILER_BLOB_CACHED, /* Results held by a compile cache */
+    D3DCOMPILER_BLOB_KIND_COUNT
+} D3DCOMPILER_BLOB_KIND;
+
+typedef struct D3DCOMPILER_MEMORY_STATS
+{
+    SIZE_T Bytes[D3DCOMPILER_BLOB_KIND_COUNT];
+    SIZE_T Count[D3DCOMPILER_BLOB_KIND_COUNT];
+    SIZE_T TotalBytes;
+    SIZE_T HighWaterBytes; /* Peak TotalBytes since the last reset */
+    SIZE_T Budget; /* 0 if no budget is set */
+} D3DCOMPILER_MEMORY_STATS;
+
+/* Called after a blob is created while TotalBytes exceeds the budget, on the
+ * thread that created it. No library locks are held, so the callback may
+ * Release blobs to get back under budget.
+ *
+ * fx_2_ effects compile their shaders on worker threads owned by the library,
+ * so the callback may also run on those threads, and several calls may run
+ * at the same time.
+ */
+typedef void (*PFN_D3DCOMPILER_BUDGET_CALLBACK)(
+    const D3DCOMPILER_MEMORY_STATS *pStats,
+    void *pUserData
+);
+
+void WINAPI D3DCompilerGetMemoryStats(D3DCOMPILER_MEMORY_STATS *pStats);
+
+void WINAPI D3DCompilerResetHighWaterMark(void);
+
+/* A Budget of 0 removes the budget. Blob creation never fails because of the
+ * budget; it is up to Callback to bring usage back down.
+ */
+void WINAPI D3DCompilerSetMemoryBudget(
+    SIZE_T Budget,
+    PFN_D3DCOMPILER_BUDGET_CALLBACK Callback,
+    void *pUserData
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* D3DCOMPILER_NATIVE_H */